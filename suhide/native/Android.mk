@@ -7,7 +7,7 @@ LDLIBS := -ldl -llog
 
 include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES := util.c trace.c config.c suhide.c
+LOCAL_SRC_FILES := util.c stats.c eventlog.c record.c trace.c policy.c sharedpolicy.c config.c prochandle.c package.c procconn.c pidtable.c mountinfo.c rules.c plan.c unmount.c nsworker.c suhide.c
 
 LOCAL_MODULE := suhide64
 LOG_TAG := suhide64
@@ -27,7 +27,7 @@ include $(BUILD_EXECUTABLE)
 
 include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES := util.c getevent.c suhide_launcher.c
+LOCAL_SRC_FILES := util.c policy.c sharedpolicy.c config.c procconn.c getevent.c suhide_launcher.c
 
 LOCAL_MODULE := suhide
 LOG_TAG := suhide
@@ -39,6 +39,26 @@ include $(BUILD_EXECUTABLE)
 
 include $(CLEAR_VARS)
 
+LOCAL_SRC_FILES := policy.c suhide_compile.c
+
+LOCAL_MODULE := suhide_compile
+
+LOCAL_CFLAGS := $(FLAGS)
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := suhide_events.c
+
+LOCAL_MODULE := suhide_events
+
+LOCAL_CFLAGS := $(FLAGS)
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
 LOCAL_SRC_FILES:= \
     setpropex/setpropex.c \
     setpropex/system_properties.c \
@@ -14,44 +14,138 @@
  * limitations under the License.
  */
 
+/* The config file is watched with inotify from a side thread, which loads it and publishes
+ * the result. The monitor thread adopts published configs in load_config() with a single
+ * atomic exchange, so checking policy on app launch does not touch the filesystem. If the
+ * config directory cannot be watched, load_config() falls back to checking the file's mtime.
+ *
+ * The text file is the source of truth. If suhide_compile has written a binary policy for the
+ * text file's current size and mtime, that is mapped instead of parsing the text.
+ *
+ * When launched by the launcher, tracers do none of this: the launcher loads and watches the
+ * config and shares it with them (see sharedpolicy.c).
+ */
+
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
 
 #include "ndklog.h"
+#include "policy.h"
+#include "sharedpolicy.h"
+#include "config.h"
+
+#define UIDDIR "/sbin/supersu/suhide"
+#define UIDNAME "suhide.uid"
+#define UIDFILE UIDDIR "/" UIDNAME
+#define UIDBINNAME UIDNAME ".bin"
+#define UIDBIN UIDDIR "/" UIDBINNAME
 
-#ifndef AID_USER
-#define AID_USER 100000
-#endif
-#ifndef AID_APP
-#define AID_APP 10000
-#endif
+// loaded policy, either mapped from UIDBIN or compiled from UIDFILE
+struct config {
+    struct policy* policy;
+    size_t size;
+    int mapped;
+};
 
-#define UIDFILE "/sbin/supersu/suhide/suhide.uid"
+// config used by the lookups, only touched by the monitor thread
+static struct config* current = NULL;
 
-static uid_t* uids = NULL;
-static int uid_count = 0;
+// config loaded by the watcher thread that load_config() has not picked up yet
+static struct config* pending = NULL;
 
-static char** processes = NULL;
-static int process_count = 0;
+// is the watcher thread running ?
+static int watching = 0;
+
+// are we publishing the config to the shared segment (launcher) ?
+static int sharing = 0;
+
+// are we using the shared segment instead of loading the config ourselves (tracers) ?
+static int shared = 0;
+
+// another file in UIDDIR the watcher thread reports changes of, see config_watch_file()
+static const char* extra_name = NULL;
+static void (*extra_changed)() = NULL;
 
 static time_t last_uid_time = 0;
 
-// load uids and process names root should be hidden from, checks last modification of config file
-void load_config() {
+// generation of the last mapped policy (0 if compiled from text), only touched by the
+// loading thread
+static uint32_t last_generation = 0;
+
+static void free_config(struct config* config) {
+    if (config == NULL) return;
+    if (config->mapped) {
+        munmap(config->policy, config->size);
+    } else {
+        free(config->policy);
+    }
+    free(config);
+}
+
+static uint64_t mtime_ns(const struct stat* stat) {
+    return (uint64_t)stat->st_mtim.tv_sec * 1000000000ULL + (uint64_t)stat->st_mtim.tv_nsec;
+}
+
+// map UIDBIN if it was compiled from source, sets matched if so. Returns NULL if it was not,
+// or if it is the generation we already have
+static struct config* map_binary(const struct stat* source, int* matched) {
+    *matched = 0;
+    int fd = open(UIDBIN, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct policy header;
     struct stat stat;
-    lstat(UIDFILE, &stat);
-    if (stat.st_mtime == last_uid_time) return;
-    last_uid_time = stat.st_mtime;
+    if ((pread(fd, &header, sizeof(header), 0) != sizeof(header)) || (fstat(fd, &stat) != 0) ||
+            (header.magic != POLICY_MAGIC) || (header.version != POLICY_VERSION) ||
+            (header.source_size != (uint64_t)source->st_size) || (header.source_mtime != mtime_ns(source))) {
+        close(fd);
+        return NULL;
+    }
+    if (header.generation == last_generation) {
+        close(fd);
+        *matched = 1;
+        return NULL;
+    }
 
-    int fd = open(UIDFILE, O_RDONLY);
-    if (fd < 0) return;
+    size_t size = (size_t)stat.st_size;
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
 
-    int buf_size = (int)stat.st_size;
-    char buf[buf_size];
+    struct config* config = (struct config*)malloc(sizeof(struct config));
+    if ((config == NULL) || (policy_verify((struct policy*)data, size) != 0)) {
+        LOGD("config: [%s] invalid", UIDBIN);
+        free(config);
+        munmap(data, size);
+        return NULL;
+    }
+    config->policy = (struct policy*)data;
+    config->size = size;
+    config->mapped = 1;
+    *matched = 1;
+    last_generation = config->policy->generation;
+    LOGD("config: mapped generation %u", last_generation);
+    return config;
+}
+
+// compile UIDFILE in memory, returns NULL if the file cannot be read or is empty
+static struct config* compile_text(int fd, const struct stat* stat) {
+    int buf_size = (int)stat->st_size + 1;
+    char* buf = (char*)malloc(buf_size);
+    if (buf == NULL) return NULL;
     int buf_read = 0;
 
-    while (1) {
+    while (buf_read < buf_size - 1) {
         int r = read(fd, &buf[buf_read], buf_size - buf_read - 1);
         if (r > 0) {
             buf_read += r;
@@ -60,84 +154,184 @@ void load_config() {
         }
     }
 
-    if (buf_read == 0) {
-        close(fd);
-        return;
+    struct config* config = NULL;
+    struct policy* policy = buf_read > 0 ? policy_compile(buf, buf_read, 0) : NULL;
+    free(buf);
+    if (policy != NULL) {
+        config = (struct config*)malloc(sizeof(struct config));
+        if (config == NULL) {
+            free(policy);
+            return NULL;
+        }
+        config->policy = policy;
+        config->size = policy->size;
+        config->mapped = 0;
+        last_generation = 0;
+        LOGD("config: compiled %u uids, %u processes", policy->uid_count, policy->name_count);
     }
+    return config;
+}
 
-    buf[buf_read] = '\0';
-    buf_read++;
+// load uids and process names root should be hidden from, returns NULL if nothing (new)
+// could be loaded
+static struct config* load() {
+    int fd = open(UIDFILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
 
-    if (uids != NULL) {
-        free(uids);
-        uids = NULL;
-    }
-    if (processes != NULL) {
-        free(processes);
-        processes = NULL;
+    struct config* config = NULL;
+    struct stat stat;
+    if (fstat(fd, &stat) == 0) {
+        int matched;
+        config = map_binary(&stat, &matched);
+        if (!matched) config = compile_text(fd, &stat);
     }
-    int count_uid = 0;
-    int count_process = 0;
-    for (int loop = 0; loop < 2; loop++) {
-        if (loop == 1) {
-            uids = (uid_t*)malloc(sizeof(uid_t) * count_uid);
-            uid_count = count_uid;
-            count_uid = 0;
-
-            processes = (char**)malloc(sizeof(char*) * count_process);
-            process_count = count_process;
-            count_process = 0;
+    close(fd);
+    return config;
+}
+
+// watcher thread, reloads the config whenever the text or binary file has been rewritten
+// or replaced
+static void* watch_main(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    char events[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (1) {
+        ssize_t len = read(fd, events, sizeof(events));
+        if (len <= 0) {
+            if ((len < 0) && (errno == EINTR)) continue;
+            break;
         }
 
-        int start = 0;
-        for (int i = 0; i < buf_read; i++) {
-            if ((buf[i] == '\r') || (buf[i] == '\n') || (buf[i] == ' ')) buf[i] = '\0';
-            if (buf[i] == '\0') {
-                if ((start > -1) && (start < i - 1)) {
-                    uid_t uid = atoi(&buf[start]);
-                    if (uid > 0) {
-                        if (loop == 1) {
-                            LOGD("[%d] uid[%d]-->[%d]", getpid(), count_uid, uid);
-                            uids[count_uid] = uid;
-                        }
-                        count_uid++;
-                    } else {
-                        if (loop == 1) {
-                            LOGD("[%d] process[%d]-->[%s]", getpid(), count_process, &buf[start]);
-                            processes[count_process] = malloc(strlen(&buf[start]) + 1);
-                            strcpy(processes[count_process], &buf[start]);
-                        }
-                        count_process++;
-                    }
-                }
-                start = i + 1;
-            }
+        int changed = 0;
+        int extra = 0;
+        for (char* p = events; p < events + len; ) {
+            struct inotify_event* event = (struct inotify_event*)p;
+            if ((event->len > 0) && ((strcmp(event->name, UIDNAME) == 0) || (strcmp(event->name, UIDBINNAME) == 0))) changed = 1;
+            if ((event->len > 0) && (extra_name != NULL) && (strcmp(event->name, extra_name) == 0)) extra = 1;
+            p += sizeof(struct inotify_event) + event->len;
         }
-    }
+        if (extra) extra_changed();
+        if (!changed || shared) continue;
 
+        struct config* config = load();
+        if (config == NULL) continue; // keep the previous config, like load_config() does
+        if (sharing) sharedpolicy_publish(config->policy);
+        free_config(__atomic_exchange_n(&pending, config, __ATOMIC_ACQ_REL));
+        LOGD("config: reloaded");
+    }
+    LOGD("config: watcher stopped");
     close(fd);
+    return NULL;
 }
 
-// is root access allowed for gid ?
-int allow_root_for_uid(gid_t gid) {
-    if ((gid % AID_USER) < AID_APP) return 1;
+// have the watcher thread also call changed whenever name in UIDDIR has been rewritten or
+// replaced, from the watcher thread. Must be called before config_watch()
+void config_watch_file(const char* name, void (*changed)()) {
+    extra_name = name;
+    extra_changed = changed;
+}
+
+// load the config and start watching it for changes, after which load_config() no longer
+// hits the filesystem. If the config is shared, the watcher is only started for the file set
+// with config_watch_file(). Returns 0 if watching (or there is nothing to watch), 1 if we are
+// left with the mtime-based fallback
+int config_watch() {
+    if (watching || (shared && (extra_name == NULL))) return 0;
+
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) return 1;
+
+    // watch the directory rather than the file, so a config replaced by rename is seen too
+    if (inotify_add_watch(fd, UIDDIR, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(fd);
+        return 1;
+    }
 
-    if (uid_count == 0) return 1;
+    // load after the watch is in place, so no change goes unnoticed
+    struct config* config = shared ? NULL : load();
+    if (config != NULL) {
+        if (sharing) sharedpolicy_publish(config->policy);
+        free_config(current);
+        current = config;
+    }
 
-    for (int i = 0; i < uid_count; i++) {
-        if (uids[i] == gid) return 0;
+    // the watcher handles no signals, started with all of them blocked it cannot be picked
+    // to receive (and drop) one meant for the thread that waits for it
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+    int ret = pthread_create(&thread, &attr, watch_main, (void*)(intptr_t)fd);
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (ret != 0) {
+        close(fd);
+        return 1;
     }
 
-    return 1;
+    watching = 1;
+    return 0;
 }
 
-// is root access allowed for process name ?
-int allow_root_for_name(char* name) {
-    if (process_count == 0) return 1;
+// load and watch the config, and publish it to a shared segment for our children, returns
+// the segment's fd to pass to them, or -1 on failure
+int config_share() {
+    int fd = sharedpolicy_create();
+    if (fd < 0) return -1;
+    sharing = 1;
+    if (config_watch() != 0) {
+        // we could not keep it up-to-date, children must load the config themselves
+        sharing = 0;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-    for (int i = 0; i < process_count; i++) {
-        if (strcmp(processes[i], name) == 0) return 0;
+// use the config shared by our parent instead of loading it, returns 0 on success
+int config_attach(int fd) {
+    if (sharedpolicy_attach(fd) != 0) return 1;
+    shared = 1;
+    return 0;
+}
+
+// load uids and process names root should be hidden from. Picks up the config last published
+// by the watcher thread, or without it, checks last modification of config file
+void load_config() {
+    if (shared) return;
+    if (watching) {
+        struct config* config = __atomic_exchange_n(&pending, NULL, __ATOMIC_ACQUIRE);
+        if (config != NULL) {
+            free_config(current);
+            current = config;
+        }
+        return;
     }
 
-    return 1;
-}
\ No newline at end of file
+    struct stat stat;
+    if (lstat(UIDFILE, &stat) != 0) return;
+    if (stat.st_mtime == last_uid_time) return;
+    last_uid_time = stat.st_mtime;
+
+    struct config* config = load();
+    if (config == NULL) return;
+    free_config(current);
+    current = config;
+}
+
+// is root access allowed for gid ?
+int allow_root_for_uid(gid_t gid) {
+    if (shared) return sharedpolicy_allow_uid(gid);
+    if (current == NULL) return 1;
+    return policy_allow_uid(current->policy, current->size, gid);
+}
+
+// is root access allowed for process name ?
+int allow_root_for_name(char* name) {
+    if (shared) return sharedpolicy_allow_name(name);
+    if (current == NULL) return 1;
+    return policy_allow_name(current->policy, current->size, name);
+}
@@ -17,6 +17,10 @@
 #ifndef _CONFIG_H
 #define _CONFIG_H
 
+void config_watch_file(const char* name, void (*changed)());
+int config_watch();
+int config_share();
+int config_attach(int fd);
 void load_config();
 int allow_root_for_uid(gid_t gid);
 int allow_root_for_name(char* name);
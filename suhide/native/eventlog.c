@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Always-on event log: a fixed-size ring of binary records in a file mapped shared, cheap
+ * enough to write from the hot path, and decoded after the fact with suhide_events. Any
+ * thread may write; slots are claimed with an atomic increment and published by writing
+ * their sequence number last.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "ndklog.h"
+#include "util.h"
+#include "eventlog.h"
+
+static struct eventlog* ring = NULL;
+
+// create and map the event log file, returns 0 on success. Until then, writes are dropped
+int eventlog_open(const char* path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return 1;
+    if (ftruncate(fd, sizeof(struct eventlog)) != 0) {
+        close(fd);
+        return 1;
+    }
+    void* data = mmap(NULL, sizeof(struct eventlog), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return 1;
+
+    struct eventlog* mapped = (struct eventlog*)data;
+    mapped->version = EVENTLOG_VERSION;
+    mapped->capacity = EVENTLOG_CAPACITY;
+    mapped->pid = getpid();
+    __atomic_store_n(&mapped->magic, EVENTLOG_MAGIC, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring, mapped, __ATOMIC_RELEASE);
+    LOGD("eventlog: [%s]", path);
+    return 0;
+}
+
+// append a record, see eventlog.h for the meaning of the fields per type
+void eventlog_write(int type, pid_t pid, int event, int decision, int err, int arg) {
+    struct eventlog* target = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+    if (target == NULL) return;
+
+    uint32_t index = __atomic_fetch_add(&target->head, 1, __ATOMIC_RELAXED);
+    struct eventlog_record* record = &target->records[index & (EVENTLOG_CAPACITY - 1)];
+
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->pid = pid;
+    record->time = monotonic_ns();
+    record->type = type;
+    record->event = event;
+    record->decision = decision;
+    record->err = err;
+    record->arg = arg;
+    __atomic_store_n(&record->seq, index + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _EVENTLOG_H
+#define _EVENTLOG_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define EVENTLOG_MAGIC 0x56454853 // "SHEV"
+#define EVENTLOG_VERSION 1
+#define EVENTLOG_CAPACITY 8192 // records, power of two
+
+// record types
+enum {
+    EVENTLOG_ATTACH = 1,    // attached to zygote, err set on failure, decision is 1 if seized
+    EVENTLOG_STOP,          // ptrace stop, event is the ptrace event, arg the signal
+    EVENTLOG_FORK,          // zygote forked pid, arg is zygote
+    EVENTLOG_CLONE,         // thread pid created, arg is its leader
+    EVENTLOG_DETECT,        // package detected, decision is 1 if root is hidden
+    EVENTLOG_UNMOUNT_START, // decision is 1 if on a forked helper rather than a worker
+    EVENTLOG_UNMOUNT_FAIL,  // a single unmount failed, err set
+    EVENTLOG_UNMOUNT_DONE,  // arg is the number unmounted, decision is 1 if any failed
+    EVENTLOG_DETACH,        // detached from all of pid's threads
+    EVENTLOG_EXIT,          // traced pid exited or was killed, arg is the wait status
+    EVENTLOG_TRACE_ERROR,   // ptrace request arg failed, err set
+    EVENTLOG_SECONDARY,     // pid is a secondary zygote and stays traced, arg is its zygote
+    EVENTLOG_TYPES
+};
+
+struct eventlog_record {
+    uint32_t seq;           // index + 1 of this record, 0 while being written
+    int32_t pid;
+    uint64_t time;          // CLOCK_MONOTONIC, ns
+    uint16_t type;
+    uint8_t event;
+    uint8_t decision;
+    int32_t err;
+    int32_t arg;
+    uint32_t reserved;
+};
+
+/* Layout of the event log file: the header followed by EVENTLOG_CAPACITY records. head is
+ * the number of records ever written, record i lives at i % EVENTLOG_CAPACITY. A record is
+ * only valid if its seq is i + 1, both before and after reading it.
+ */
+struct eventlog {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t pid;
+    uint32_t head;
+    uint32_t reserved[3];
+    struct eventlog_record records[EVENTLOG_CAPACITY];
+};
+
+int eventlog_open(const char* path);
+void eventlog_write(int type, pid_t pid, int event, int decision, int err, int arg);
+
+#endif
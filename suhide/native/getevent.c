@@ -20,99 +20,205 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
 #include <sys/limits.h>
-#include <sys/poll.h>
 #include <linux/input.h>
 #include <errno.h>
 
-static struct pollfd* ufds = NULL;
-static int nfds = 0;
+#include "getevent.h"
 
-// opens an input device, returns 0 on success
-static int open_device(const char* device) {
+static const char* device_path = "/dev/input";
+
+// an open input device, by its name in device_path
+struct device {
     int fd;
-    struct pollfd* new_ufds;
+    char name[NAME_MAX + 1];
+};
+
+static struct device* devices = NULL;
+static int ndevices = 0;
+
+// epoll set the device fds and the inotify fd are added to
+static int epoll_fd = -1;
+
+// inotify watch on device_path, to add and remove devices as they come and go
+static int inotify_fd = -1;
+
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define BITS_TO_LONGS(bits) (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define TEST_BIT(bit, array) ((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+// does the device report the volume keys ? Others, like touchscreens and sensors which can
+// produce thousands of events per second, are not worth waking up for
+static int has_volume_keys(int fd) {
+    unsigned long keys[BITS_TO_LONGS(KEY_CNT)];
+    memset(keys, 0, sizeof(keys));
+    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) < 0) return 0;
+    return TEST_BIT(KEY_VOLUMEUP, keys) || TEST_BIT(KEY_VOLUMEDOWN, keys);
+}
+
+// have the kernel deliver only volume key events from the device (Linux 4.4+), so other keys
+// and sync events on the same device don't wake us either. Best effort
+static void mask_events(int fd) {
+#ifdef EVIOCSMASK
+    unsigned long codes[BITS_TO_LONGS(KEY_CNT)];
+    struct input_mask mask;
+    for (unsigned int type = 0; type < EV_CNT; type++) {
+        memset(codes, 0, sizeof(codes));
+        if (type == EV_KEY) {
+            codes[KEY_VOLUMEUP / BITS_PER_LONG] |= 1UL << (KEY_VOLUMEUP % BITS_PER_LONG);
+            codes[KEY_VOLUMEDOWN / BITS_PER_LONG] |= 1UL << (KEY_VOLUMEDOWN % BITS_PER_LONG);
+        }
+        mask.type = type;
+        mask.codes_size = sizeof(codes);
+        mask.codes_ptr = (uint64_t)(uintptr_t)codes;
+        // fails with EINVAL for types that can't be masked, and ENOTTY on older kernels
+        if ((ioctl(fd, EVIOCSMASK, &mask) < 0) && (errno == ENOTTY)) return;
+    }
+#else
+    (void)fd;
+#endif
+}
+
+// opens an input device with volume keys and adds it to the epoll set, returns 0 on success.
+// A device created between adding the watch and scanning is seen by both, it is opened once
+static int open_device(const char* name) {
+    char devname[PATH_MAX];
+    int fd;
+    struct device* new_devices;
     int version;
     struct input_id id;
 
-    fd = open(device, O_RDWR);
+    for (int i = 0; i < ndevices; i++) {
+        if (strcmp(devices[i].name, name) == 0) return 0;
+    }
+
+    snprintf(devname, sizeof(devname), "%s/%s", device_path, name);
+    fd = open(devname, O_RDWR | O_CLOEXEC);
     if (fd < 0) return -1;
-    if (ioctl(fd, EVIOCGVERSION, &version)) return -1;
-    if (ioctl(fd, EVIOCGID, &id)) return -1;
+    if (ioctl(fd, EVIOCGVERSION, &version) || ioctl(fd, EVIOCGID, &id) || !has_volume_keys(fd)) {
+        close(fd);
+        return -1;
+    }
+    mask_events(fd);
 
-    new_ufds = (struct pollfd*)realloc(ufds, sizeof(ufds[0]) * (nfds + 1));
-    ufds = new_ufds;
-    ufds[nfds].fd = fd;
-    ufds[nfds].events = POLLIN;
-    nfds++;
+    new_devices = (struct device*)realloc(devices, sizeof(devices[0]) * (ndevices + 1));
+    if (new_devices == NULL) {
+        close(fd);
+        return -1;
+    }
+    devices = new_devices;
 
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    devices[ndevices].fd = fd;
+    snprintf(devices[ndevices].name, sizeof(devices[ndevices].name), "%s", name);
+    ndevices++;
     return 0;
 }
 
-// scan a dir and open all contained input devices
-static int scan_dir(const char* dirname) {
-    char devname[PATH_MAX];
-    char* filename;
+// closes device i and removes it from the epoll set
+static void close_device(int i) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, devices[i].fd, NULL);
+    close(devices[i].fd);
+    devices[i] = devices[--ndevices];
+}
+
+// closes the device named name, if open
+static void close_device_name(const char* name) {
+    for (int i = 0; i < ndevices; i++) {
+        if (strcmp(devices[i].name, name) == 0) {
+            close_device(i);
+            return;
+        }
+    }
+}
+
+// scan device_path and open all contained input devices
+static int scan_dir() {
     DIR* dir;
     struct dirent* de;
-    dir = opendir(dirname);
+    dir = opendir(device_path);
     if (dir == NULL)
         return -1;
-    strcpy(devname, dirname);
-    filename = devname + strlen(devname);
-    *filename++ = '/';
     while ((de = readdir(dir))) {
         if ((de->d_name[0] == '.' && de->d_name[1] == '\0') ||
            (de->d_name[1] == '.' && de->d_name[2] == '\0'))
             continue;
-        strcpy(filename, de->d_name);
-        open_device(devname);
+        open_device(de->d_name);
     }
     closedir(dir);
     return 0;
 }
 
-// (re-)init event monitoring
-void reset_getevent() {
-    const char* device_path = "/dev/input";
-    if (ufds != NULL) {
-        int i;
-        for (i = 0; i < nfds; i++) {
-            close(ufds[i].fd);
+// handle pending inotify events, opening created devices and closing deleted ones
+static void read_notify() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+            struct inotify_event* event = (struct inotify_event*)p;
+            if (event->len == 0) continue;
+            if (event->mask & IN_CREATE) {
+                open_device(event->name);
+            } else if (event->mask & IN_DELETE) {
+                close_device_name(event->name);
+            }
         }
-        free(ufds);
-        ufds = NULL;
     }
-    nfds = 0;
-    scan_dir(device_path);
 }
 
-// get most recent event with a timeout. returns number of events returned [0..1] or -1 on error
-int get_event(struct input_event* event, int timeout) {
-    int res;
-    int i;
-    int pollres;
-    while (1) {
-        pollres = poll(ufds, nfds, timeout);
-        if (pollres == 0) {
-            return 0;
-        } else if (pollres == -1) {
-            return -1;
+// start monitoring input: watch device_path for hotplug and open all input devices in it,
+// adding their fds to epfd. Returns 0 on success
+int open_getevent(int epfd) {
+    epoll_fd = epfd;
+
+    // watch before scanning, so devices added in between are not missed
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = inotify_fd;
+        if ((inotify_add_watch(inotify_fd, device_path, IN_CREATE | IN_DELETE) < 0) ||
+                (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &event) != 0)) {
+            close(inotify_fd);
+            inotify_fd = -1;
         }
-        for (i = 0; i < nfds; i++) {
-            if (ufds[i].revents) {
-                if (ufds[i].revents & POLLIN) {
-                    res = read(ufds[i].fd, event, sizeof(*event));
-                    if (res < (int)sizeof(event)) {
-                        return -1;
-                    }
-                    return 1;
-                }
+    }
+    return scan_dir();
+}
+
+// handle fd, which epoll reported readable: read up to max pending input events into events
+// in a single read if it is a device, or add and remove devices if it is the inotify watch.
+// Returns the number of events returned. Devices that fail to read (usually because they were
+// removed) are closed
+int read_getevent(int fd, struct input_event* events, int max) {
+    if (fd == inotify_fd) {
+        read_notify();
+        return 0;
+    }
+    for (int i = 0; i < ndevices; i++) {
+        if (devices[i].fd == fd) {
+            ssize_t len = read(fd, events, sizeof(*events) * max);
+            if (len < (ssize_t)sizeof(*events)) {
+                close_device(i);
+                return 0;
             }
+            return len / sizeof(*events);
         }
     }
     return 0;
-}
\ No newline at end of file
+}
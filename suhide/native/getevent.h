@@ -19,7 +19,7 @@
 
 #include <linux/input.h>
 
-void reset_getevent();
-int get_event(struct input_event* event, int timeout);
+int open_getevent(int epfd);
+int read_getevent(int fd, struct input_event* events, int max);
 
 #endif
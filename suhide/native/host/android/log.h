@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Stand-in for the NDK's android/log.h, for building suhide's sources on a Linux host (see
+ * host/fakezygote.c). Messages go to stderr. Bionic's headers implicitly provide a few more
+ * headers that the sources rely on, those are included here too.
+ */
+
+#ifndef _HOST_ANDROID_LOG_H
+#define _HOST_ANDROID_LOG_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <signal.h>
+
+enum {
+    ANDROID_LOG_VERBOSE = 2,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR
+};
+
+static inline int __android_log_print(int prio, const char* tag, const char* fmt, ...) {
+    (void)prio;
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "%s: ", tag);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,523 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* fakezygote stands in for zygote on a Linux host, to measure the overhead suhide adds to
+ * app launches without a device. Run as root, it:
+ *
+ * - enters a private mount namespace and mounts a scratch tmpfs with mounts that the default
+ *   rules match, like SuperSU's: a tmpfs under .../system/, and a bind mount of .../data/adb/su
+ * - renames itself to zygote, and forks N "apps" that, like zygote's children, unshare their
+ *   mount namespace, drop to an app uid, rename themselves, and start threads
+ * - does this once without and once with a tracer attached, which it launches like the
+ *   launcher does, sharing a policy that hides the requested uids
+ *
+ * and reports launch latency (fork until the app's threads are running), tracer CPU time,
+ * and whether the mounts were hidden from exactly the apps they should be.
+ *
+ * With -m usap, apps are instead started from a pool of pre-forked processes named usap64
+ * that only specialize (unshare, drop uid, rename) once asked to, like Android 10+'s USAP
+ * pool, which is refilled after every launch. With -m secondary, zygote forks a secondary
+ * zygote like an app zygote or webview_zygote: it specializes to a non-hidden uid and its own
+ * namespace, and forks the apps in turn. Latency is then measured from the request.
+ *
+ * With -c N, apps are launched N at a time rather than one after the other, like during boot,
+ * so the tracer has several unmounts in flight. The launch rate is reported as well.
+ *
+ * With -b, the tracer runs the given backend: ptrace (the default), seize, or procconn, which
+ * follows zygote through the proc connector without tracing it. Running the same launches
+ * against each compares what the backends cost zygote and its children. The backends do not
+ * hide equally well: procconn only stops an app once the event for its uid or name change
+ * has been read, and an app that looks at its mounts before then sees them. Those launches
+ * count as unexpected, a few per hundred with -c 8, where ptrace and seize report none.
+ *
+ * Build the tracer and fakezygote on a host from suhide/native with:
+ *
+ *     cc -std=gnu11 -D_GNU_SOURCE -O2 -Ihost -DLOG_TAG=\"suhide64\" -o suhide64 util.c stats.c \
+ *         eventlog.c record.c trace.c policy.c sharedpolicy.c config.c prochandle.c package.c \
+ *         procconn.c pidtable.c mountinfo.c rules.c plan.c unmount.c nsworker.c suhide.c -lpthread
+ *     cc -std=gnu11 -D_GNU_SOURCE -O2 -Ihost -I. -DLOG_TAG=\"fakezygote\" -o fakezygote \
+ *         host/fakezygote.c util.c policy.c sharedpolicy.c -lpthread
+ *
+ * and run, for example:
+ *
+ *     sudo ./fakezygote -n 200 -u 10050,10051 -H 10050 ./suhide64
+ *     sudo ./fakezygote -m secondary -b seize ./suhide64
+ *     sudo ./fakezygote -n 1000 -b procconn ./suhide64
+ *     sudo ./fakezygote -n 400 -c 16 ./suhide64
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mount.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "util.h"
+#include "policy.h"
+#include "sharedpolicy.h"
+
+#define MAX_UIDS 64
+
+// USAP pool size, and the uid the secondary zygote runs as
+#define POOL_SIZE 4
+#define SECONDARY_UID 10099
+
+// how apps are started, see -m
+enum { MODE_FORK, MODE_USAP, MODE_SECONDARY };
+
+// request to start an app, sent to a pool process or the secondary zygote
+struct command {
+    uid_t uid;
+    int index;
+};
+
+// outcome of a single launch, reported by the app
+struct launch {
+    uint64_t running;   // monotonic_ns() once all threads were started
+    int visible;        // root-related mounts still present
+    int index;
+    pid_t pid;
+};
+
+// command line area, overwritten to rename ourselves
+static char* argv_start = NULL;
+static size_t argv_size = 0;
+
+// scratch tmpfs the root-related mounts live under
+static char scratch[] = "/tmp/fakezygote.XXXXXX";
+
+static int threads = 2;
+static int mode = MODE_FORK;
+static int concurrent = 1;
+
+// commands to pool processes or the secondary zygote, and launch results from apps
+static int command_fds[2] = { -1, -1 };
+static int result_fds[2] = { -1, -1 };
+
+// pool processes waiting for a command, and the secondary zygote
+static pid_t pool[POOL_SIZE];
+static pid_t server = 0;
+
+// rename ourselves in both /proc/<pid>/cmdline and comm
+static void set_name(const char* name) {
+    memset(argv_start, 0, argv_size);
+    strncpy(argv_start, name, argv_size - 1);
+    prctl(PR_SET_NAME, name);
+}
+
+// parse a comma-separated uid list into uids, returns the count
+static int parse_uids(char* list, uid_t* uids) {
+    int count = 0;
+    for (char* token = strtok(list, ","); (token != NULL) && (count < MAX_UIDS); token = strtok(NULL, ",")) {
+        uids[count++] = (uid_t)atoi(token);
+    }
+    return count;
+}
+
+// mount a scratch tmpfs with mounts resembling SuperSU's, in our own namespace, returns 0 on success
+static int setup_mounts() {
+    if (unshare(CLONE_NEWNS) != 0) return 1;
+    if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0) return 1;
+    if (mkdtemp(scratch) == NULL) return 1;
+    if (mount("tmpfs", scratch, "tmpfs", 0, "size=1m") != 0) return 1;
+
+    char path[PATH_MAX], source[PATH_MAX];
+    const char* dirs[] = { "system", "system/xbin", "vendor", "vendor/lib", "data", "data/adb", "data/adb/su", "sbin" };
+    for (unsigned int i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        snprintf(path, PATH_MAX, "%s/%s", scratch, dirs[i]);
+        if (mkdir(path, 0755) != 0) return 1;
+    }
+
+    // target contains /system/ and /vendor/
+    snprintf(path, PATH_MAX, "%s/system/xbin", scratch);
+    if (mount("tmpfs", path, "tmpfs", 0, "size=64k") != 0) return 1;
+    snprintf(path, PATH_MAX, "%s/vendor/lib", scratch);
+    if (mount("tmpfs", path, "tmpfs", 0, "size=64k") != 0) return 1;
+
+    // root contains /adb/su, like SuperSU's /sbin bind mount
+    snprintf(source, PATH_MAX, "%s/data/adb/su", scratch);
+    snprintf(path, PATH_MAX, "%s/sbin", scratch);
+    if (mount(source, path, NULL, MS_BIND, NULL) != 0) return 1;
+    return 0;
+}
+
+// count mounts below scratch in our namespace
+static int count_visible() {
+    FILE* file = fopen("/proc/self/mountinfo", "r");
+    if (file == NULL) return -1;
+    char line[4096];
+    char prefix[PATH_MAX];
+    snprintf(prefix, PATH_MAX, " %s/", scratch);
+    int count = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strstr(line, prefix) != NULL) count++;
+    }
+    fclose(file);
+    return count;
+}
+
+static void* app_thread(void* arg) {
+    (void)arg;
+    return NULL;
+}
+
+// body of a forked app, does what zygote's children do up to starting their threads
+static void app_main(int fd, uid_t uid, int index) {
+    struct launch launch;
+    char name[32];
+    pthread_t thread[16];
+
+    if (unshare(CLONE_NEWNS) != 0) _exit(1);
+    if ((setresgid(uid, uid, uid) != 0) || (setresuid(uid, uid, uid) != 0)) _exit(1);
+    snprintf(name, sizeof(name), "com.fake.app%d", index);
+    set_name(name);
+
+    // the tracer detects the package at the first clone after the rename
+    int started = 0;
+    for (int i = 0; (i < threads) && (i < 16); i++) {
+        if (pthread_create(&thread[i], NULL, app_thread, NULL) == 0) started++;
+    }
+    launch.running = monotonic_ns();
+    for (int i = 0; i < started; i++) pthread_join(thread[i], NULL);
+    launch.visible = count_visible();
+    launch.index = index;
+    launch.pid = getpid();
+    if (write(fd, &launch, sizeof(launch)) != sizeof(launch)) _exit(1);
+    _exit(0);
+}
+
+// read a command, returns 0 on success, 1 once the other end is closed
+static int read_command(struct command* command) {
+    ssize_t len;
+    do {
+        len = read(command_fds[0], command, sizeof(*command));
+    } while ((len < 0) && (errno == EINTR));
+    return len == sizeof(*command) ? 0 : 1;
+}
+
+// body of a USAP pool process: waits as usap64 until asked to specialize into an app
+static void pool_main() {
+    struct command command;
+    close(command_fds[1]);
+    close(result_fds[0]);
+    set_name("usap64");
+    if (read_command(&command) != 0) _exit(0);
+    app_main(result_fds[1], command.uid, command.index);
+}
+
+static void* server_thread(void* arg) {
+    (void)arg;
+    return NULL;
+}
+
+// body of the secondary zygote: specializes like an app (keeping root as saved uid so it can
+// setresuid its forks), then forks an app per command
+static void server_main() {
+    struct command command;
+    close(command_fds[1]);
+    close(result_fds[0]);
+    signal(SIGCHLD, SIG_IGN);
+
+    if (unshare(CLONE_NEWNS) != 0) _exit(1);
+    if ((setresgid(SECONDARY_UID, SECONDARY_UID, 0) != 0) || (setresuid(SECONDARY_UID, SECONDARY_UID, 0) != 0)) _exit(1);
+    prctl(PR_SET_DUMPABLE, 1);
+    set_name("com.fake.server_zygote");
+
+    // like any app, it's detected at its first clone after the rename
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, server_thread, NULL) == 0) pthread_join(thread, NULL);
+
+    while (read_command(&command) == 0) {
+        if (fork() == 0) {
+            close(command_fds[0]);
+            if ((setresuid(0, 0, 0) != 0) || (setresgid(0, 0, 0) != 0)) _exit(1);
+            app_main(result_fds[1], command.uid, command.index);
+        }
+    }
+    _exit(0);
+}
+
+// fork a pool process into slot, returns 0 on success
+static int fork_pool(int slot) {
+    pool[slot] = fork();
+    if (pool[slot] == 0) pool_main();
+    return pool[slot] > 0 ? 0 : 1;
+}
+
+// create the pipes, and the pool or secondary zygote for the mode, returns 0 on success
+static int open_mode() {
+    if ((pipe(command_fds) != 0) || (pipe(result_fds) != 0)) return 1;
+    if (mode == MODE_USAP) {
+        for (int i = 0; i < POOL_SIZE; i++) {
+            if (fork_pool(i) != 0) return 1;
+        }
+    } else if (mode == MODE_SECONDARY) {
+        server = fork();
+        if (server == 0) server_main();
+        if (server < 0) return 1;
+    }
+    return 0;
+}
+
+// make the pool or secondary zygote exit, and close the pipes
+static void close_mode() {
+    close(command_fds[1]);
+    if (mode == MODE_USAP) {
+        for (int i = 0; i < POOL_SIZE; i++) {
+            if (pool[i] > 0) waitpid(pool[i], NULL, 0);
+        }
+    } else if (mode == MODE_SECONDARY) {
+        waitpid(server, NULL, 0);
+    }
+    close(command_fds[0]);
+    close(result_fds[0]);
+    close(result_fds[1]);
+}
+
+// start app index as uid, returns 0 on success
+static int start_launch(uid_t uid, int index) {
+    if (mode == MODE_FORK) {
+        pid_t app = fork();
+        if (app == 0) {
+            close(result_fds[0]);
+            app_main(result_fds[1], uid, index);
+        }
+        if (app < 0) return 1;
+    } else {
+        struct command command = { uid, index };
+        if (write(command_fds[1], &command, sizeof(command)) != sizeof(command)) return 1;
+    }
+    return 0;
+}
+
+// wait for the outcome of the next app to finish starting, returns 0 on success
+static int finish_launch(struct launch* launch) {
+    struct pollfd pfd = { result_fds[0], POLLIN, 0 };
+    if ((poll(&pfd, 1, 5000) != 1) || (read(result_fds[0], launch, sizeof(*launch)) != sizeof(*launch))) return 1;
+
+    if (mode != MODE_SECONDARY) waitpid(launch->pid, NULL, 0);
+    if (mode == MODE_USAP) {
+        // refill the pool, like zygote does after a USAP is used
+        for (int i = 0; i < POOL_SIZE; i++) {
+            if (pool[i] == launch->pid) fork_pool(i);
+        }
+    }
+    return 0;
+}
+
+// read a process's user + system CPU time in ms
+static long cpu_ms(pid_t pid) {
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    int len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return -1;
+    buf[len] = '\0';
+
+    // fields 14 and 15, counted from after the parenthesized comm
+    char* p = strrchr(buf, ')');
+    if (p == NULL) return -1;
+    unsigned long utime = 0, stime = 0;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return -1;
+    return (long)((utime + stime) * 1000 / sysconf(_SC_CLK_TCK));
+}
+
+// wait until a tracer has attached to us, returns 0 on success
+static int wait_traced(int ms) {
+    char line[256];
+    for (int waited = 0; waited < ms; waited += 10) {
+        FILE* file = fopen("/proc/self/status", "r");
+        if (file != NULL) {
+            int traced = 0;
+            while (fgets(line, sizeof(line), file) != NULL) {
+                if (strncmp(line, "TracerPid:", 10) == 0) traced = atoi(&line[10]) != 0;
+            }
+            fclose(file);
+            if (traced) return 0;
+        }
+        ms_sleep(10);
+    }
+    return 1;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int is_hidden(uid_t uid, const uid_t* hide, int hide_count) {
+    for (int i = 0; i < hide_count; i++) {
+        if (hide[i] == uid) return 1;
+    }
+    return 0;
+}
+
+// launch count apps, print latency figures, returns the number of apps whose mounts were
+// not as expected
+static int run(const char* label, int count, const uid_t* uids, int uid_count, const uid_t* hide, int hide_count, int traced) {
+    // started is indexed by app, latency by completion
+    uint64_t* started = (uint64_t*)calloc(count, sizeof(uint64_t));
+    uint64_t* latency = (uint64_t*)calloc(count, sizeof(uint64_t));
+    if ((started == NULL) || (latency == NULL) || (open_mode() != 0)) {
+        free(started);
+        free(latency);
+        return count;
+    }
+    int wrong = 0;
+    int done = 0;
+    uint64_t run_started = monotonic_ns();
+    for (int i = 0; i < count; i += concurrent) {
+        // a batch of launches at once, then their outcomes in the order they finish
+        int batch = (count - i < concurrent) ? count - i : concurrent;
+        int pending = 0;
+        for (int j = i; j < i + batch; j++) {
+            started[j] = monotonic_ns();
+            if (start_launch(uids[j % uid_count], j) == 0) {
+                pending++;
+            } else {
+                wrong++;
+            }
+        }
+        for (; pending > 0; pending--) {
+            struct launch result;
+            if ((finish_launch(&result) != 0) || (result.index < i) || (result.index >= i + batch)) {
+                wrong++;
+                continue;
+            }
+            latency[done++] = result.running - started[result.index];
+
+            uid_t uid = uids[result.index % uid_count];
+            int expect_hidden = traced && is_hidden(uid, hide, hide_count);
+            if ((result.visible == 0) != expect_hidden) wrong++;
+        }
+    }
+    uint64_t run_ns = monotonic_ns() - run_started;
+    close_mode();
+
+    if (done > 0) {
+        qsort(latency, done, sizeof(uint64_t), compare_u64);
+        uint64_t sum = 0;
+        for (int i = 0; i < done; i++) sum += latency[i];
+        printf("%-10s %6d launches  mean %8.1f us  median %8.1f us  p99 %8.1f us  max %8.1f us  rate %7.1f/s  unexpected %d\n",
+            label, done, (double)sum / done / 1000.0, latency[done / 2] / 1000.0,
+            latency[(done * 99) / 100] / 1000.0, latency[done - 1] / 1000.0,
+            done * 1000000000.0 / run_ns, wrong);
+    }
+    free(started);
+    free(latency);
+    return wrong;
+}
+
+int main(int argc, char *argv[]) {
+    int count = 100;
+    const char* backend_arg = "ptrace";
+    uid_t uids[MAX_UIDS] = { 10050, 10051 };
+    int uid_count = 2;
+    uid_t hide[MAX_UIDS] = { 10050 };
+    int hide_count = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:u:H:t:b:m:c:")) != -1) {
+        switch (opt) {
+            case 'm':
+                if (strcmp(optarg, "usap") == 0) mode = MODE_USAP;
+                else if (strcmp(optarg, "secondary") == 0) mode = MODE_SECONDARY;
+                else if (strcmp(optarg, "fork") != 0) optind = argc + 1;
+                break;
+            case 'n': count = atoi(optarg); break;
+            case 'u': uid_count = parse_uids(optarg, uids); break;
+            case 'H': hide_count = parse_uids(optarg, hide); break;
+            case 't': threads = atoi(optarg); break;
+            case 'c': concurrent = atoi(optarg); break;
+            case 'b': backend_arg = optarg; break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if ((optind != argc - 1) || (count <= 0) || (uid_count == 0) || (concurrent <= 0)) {
+        fprintf(stderr, "Usage: %s [-n launches] [-c concurrent] [-u uid,...] [-H hidden uid,...] [-t threads] [-b ptrace|seize|procconn] [-m fork|usap|secondary] <tracer>\n", argv[0]);
+        return 1;
+    }
+    // copied, set_name() overwrites argv
+    char tracer_path[PATH_MAX];
+    snprintf(tracer_path, PATH_MAX, "%s", argv[optind]);
+    char backend[16];
+    snprintf(backend, sizeof(backend), "%s", backend_arg);
+
+    argv_start = argv[0];
+    argv_size = argv[argc - 1] + strlen(argv[argc - 1]) + 1 - argv[0];
+
+    if (setup_mounts() != 0) {
+        perror("setting up mounts (not root?)");
+        return 1;
+    }
+    set_name("zygote");
+
+    // share the policy like the launcher does
+    char text[MAX_UIDS * 12 + 1];
+    int len = 0;
+    for (int i = 0; i < hide_count; i++) {
+        len += snprintf(&text[len], sizeof(text) - len, "%u\n", hide[i]);
+    }
+    struct policy* policy = policy_compile(text, len, 1);
+    int policy_fd = sharedpolicy_create();
+    if ((policy == NULL) || (policy_fd < 0) || (sharedpolicy_publish(policy) != 0)) {
+        fprintf(stderr, "failed to share policy\n");
+        return 1;
+    }
+    free(policy);
+
+    int wrong = run("untraced", count, uids, uid_count, hide, hide_count, 0);
+
+    pid_t self = getpid();
+    pid_t tracer = fork();
+    if (tracer == 0) {
+        char param[16], policy_param[16];
+        snprintf(param, sizeof(param), "%d", self);
+        snprintf(policy_param, sizeof(policy_param), "%d", policy_fd);
+        execl(tracer_path, tracer_path, param, backend, policy_param, (char*)NULL);
+        _exit(1);
+    }
+    if ((tracer < 0) || ((strcmp(backend, "procconn") != 0) ? wait_traced(5000) : ms_sleep(500)) != 0) {
+        fprintf(stderr, "tracer did not attach\n");
+        if (tracer > 0) kill(tracer, SIGKILL);
+        return 1;
+    }
+
+    long cpu = cpu_ms(tracer);
+    wrong += run("traced", count, uids, uid_count, hide, hide_count, 1);
+    cpu = cpu_ms(tracer) - cpu;
+    printf("tracer CPU %ld ms, %.1f us per launch\n", cpu, (double)cpu * 1000.0 / count);
+
+    kill(tracer, SIGKILL);
+    waitpid(tracer, NULL, 0);
+    umount2(scratch, MNT_DETACH);
+    rmdir(scratch);
+    return wrong > 0 ? 2 : 0;
+}
@@ -0,0 +1,755 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* microbench times parts of the tracer on a host, each against the code it replaced, which is
+ * reproduced below for comparison. One mode is run per invocation:
+ *
+ * - pidtable: memory and per-event cost of the pid table with -n live tracees (default 10000,
+ *   apps of 4 threads with pids spread up to a pid_max of 4194304), against the int[PID_MAX]
+ *   first_stop, forked and parent arrays and their parent chain walk
+ * - unmount (root): latency from starting the unmount of a waiting app's namespace to its root
+ *   mounts being gone, over -n apps (default 1000), on a namespace worker against a forked
+ *   helper. The old tracer's stack arrays are resident while forking, as they were
+ * - mountinfo: parsing synthetic mountinfo files of 2000 and 10000 lines (or -n), resembling a
+ *   device with many APEX and bind mounts, with the mountinfo reader against the 32 KB read and
+ *   sscanf() loop it replaced, which only ever sees the start of such files
+ * - rules: classifying each line of such a file of 2000 lines (or -n) with the default rules,
+ *   against the strcmp() chain they replaced
+ * - policy: uid and process name decisions against hide lists of 5, 500 and 5000 uids and
+ *   names each (or -n), with the compiled policy against the linear scans it replaced
+ *
+ * Build on a host from suhide/native with:
+ *
+ *     cc -std=gnu11 -D_GNU_SOURCE -O2 -Ihost -I. -DLOG_TAG=\"microbench\" -o microbench \
+ *         host/microbench.c util.c eventlog.c prochandle.c pidtable.c mountinfo.c rules.c \
+ *         plan.c unmount.c nsworker.c policy.c -lpthread
+ *
+ * and run, for example:
+ *
+ *     ./microbench -n 50000 pidtable
+ *     sudo ./microbench unmount
+ *     ./microbench mountinfo
+ *     ./microbench -n 10000 rules
+ *     ./microbench policy
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "util.h"
+#include "pidtable.h"
+#include "prochandle.h"
+#include "rules.h"
+#include "plan.h"
+#include "unmount.h"
+#include "nsworker.h"
+#include "mountinfo.h"
+#include "policy.h"
+
+// keeps results alive so the compiler cannot drop the work that produced them
+static volatile long sink = 0;
+
+// print the cost per operation of ops operations that took ns
+static void report(const char* what, long ops, uint64_t ns) {
+    printf("%-36s %10ld ops  %10.1f ns/op\n", what, ops, (double)ns / (ops > 0 ? ops : 1));
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// print the distribution of count latencies, which are sorted in place
+static void report_latency(const char* what, uint64_t* latency, int count) {
+    if (count <= 0) return;
+    qsort(latency, count, sizeof(uint64_t), compare_u64);
+    uint64_t sum = 0;
+    for (int i = 0; i < count; i++) sum += latency[i];
+    printf("%-36s %10d runs  mean %8.1f us  median %8.1f us  p99 %8.1f us\n", what, count,
+        (double)sum / count / 1000.0, latency[count / 2] / 1000.0, latency[(count * 99) / 100] / 1000.0);
+}
+
+// resident set size in KB, or -1 if unknown
+static long rss_kb() {
+    char buf[64];
+    int fd = open("/proc/self/statm", O_RDONLY);
+    if (fd < 0) return -1;
+    int len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return -1;
+    buf[len] = '\0';
+    long size = 0, resident = 0;
+    if (sscanf(buf, "%ld %ld", &size, &resident) != 2) return -1;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// --- pidtable
+
+#define BENCH_PID_MAX 4194304
+#define BENCH_THREADS 4 // per app, including the leader
+#define BENCH_ROUNDS 20 // of lookups over all tracees
+
+// the tracer's state before the pid table, see git history. These were stack arrays in main()
+#define OLD_PID_MAX 32768
+static int old_first_stop[OLD_PID_MAX];
+static int old_forked[OLD_PID_MAX];
+static int old_parent[OLD_PID_MAX];
+
+// pid of thread t of app i, leaders are spread over the whole pid range
+static pid_t bench_pid(int i, int apps, int t) {
+    return 300 + (pid_t)((long)i * ((BENCH_PID_MAX - 400) / apps)) + t;
+}
+
+static void bench_pidtable(int count) {
+    int apps = (count + BENCH_THREADS - 1) / BENCH_THREADS;
+    count = apps * BENCH_THREADS;
+    printf("pidtable: %d tracees in %d apps\n", count, apps);
+
+    long rss = rss_kb();
+    uint64_t start = monotonic_ns();
+    for (int i = 0; i < apps; i++) {
+        pid_t leader = bench_pid(i, apps, 0);
+        struct tracee* tracee = pidtable_add(leader);
+        tracee->forked = 1;
+        tracee->leader = leader;
+        tracee->leader_generation = tracee->generation;
+        for (int t = 1; t < BENCH_THREADS; t++) {
+            struct tracee* thread = pidtable_add(bench_pid(i, apps, t));
+            thread->forked = 1;
+            thread->first_stop = 1;
+            pidtable_join(thread, leader);
+        }
+    }
+    report("pidtable add", count, monotonic_ns() - start);
+    printf("%-36s %10ld KB\n", "pidtable memory (RSS growth)", rss_kb() - rss);
+
+    // what the event loop does for every stop: find the tracee and its thread group leader
+    start = monotonic_ns();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < apps; i++) {
+            for (int t = 0; t < BENCH_THREADS; t++) {
+                sink += pidtable_leader(pidtable_get(bench_pid(i, apps, t)));
+            }
+        }
+    }
+    report("pidtable get + leader", (long)count * BENCH_ROUNDS, monotonic_ns() - start);
+
+    start = monotonic_ns();
+    for (int i = 0; i < apps; i++) {
+        pidtable_remove_group(bench_pid(i, apps, 0));
+    }
+    report("pidtable remove group (per app)", apps, monotonic_ns() - start);
+
+    // the old arrays cannot hold pids over OLD_PID_MAX at all, so they wrap here
+    start = monotonic_ns();
+    for (int i = 0; i < apps; i++) {
+        int leader = bench_pid(i, apps, 0) % OLD_PID_MAX;
+        old_first_stop[leader] = 1;
+        old_forked[leader] = 1;
+        old_parent[leader] = leader;
+        for (int t = 1; t < BENCH_THREADS; t++) {
+            int thread = bench_pid(i, apps, t) % OLD_PID_MAX;
+            old_first_stop[thread] = 1;
+            old_forked[thread] = 1;
+            old_parent[thread] = leader;
+        }
+    }
+    report("old arrays add", count, monotonic_ns() - start);
+    printf("%-36s %10ld KB at pid_max %d, %ld KB at %d\n", "old arrays memory (stack)",
+        (long)(3 * sizeof(int) * OLD_PID_MAX / 1024), OLD_PID_MAX,
+        (long)(3 * sizeof(int) * (long)BENCH_PID_MAX / 1024), BENCH_PID_MAX);
+
+    start = monotonic_ns();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < apps; i++) {
+            for (int t = 0; t < BENCH_THREADS; t++) {
+                int p = bench_pid(i, apps, t) % OLD_PID_MAX;
+                while ((p != 0) && (old_parent[p] != p)) p = old_parent[p];
+                sink += p + old_forked[p];
+            }
+        }
+    }
+    report("old arrays get + leader walk", (long)count * BENCH_ROUNDS, monotonic_ns() - start);
+
+    start = monotonic_ns();
+    for (int i = 0; i < apps; i++) {
+        for (int t = 0; t < BENCH_THREADS; t++) {
+            int p = bench_pid(i, apps, t) % OLD_PID_MAX;
+            old_first_stop[p] = 0;
+            old_forked[p] = 0;
+            old_parent[p] = 0;
+        }
+    }
+    report("old arrays remove (per app)", apps, monotonic_ns() - start);
+}
+
+// --- unmount
+
+// scratch tmpfs the root-related mounts live under, see host/fakezygote.c
+static char scratch[] = "/tmp/microbench.XXXXXX";
+
+// mount a scratch tmpfs with mounts the default rules unmount, in our own namespace, returns 0
+// on success
+static int setup_mounts() {
+    if (unshare(CLONE_NEWNS) != 0) return 1;
+    if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0) return 1;
+    if (mkdtemp(scratch) == NULL) return 1;
+    if (mount("tmpfs", scratch, "tmpfs", 0, "size=1m") != 0) return 1;
+
+    char path[PATH_MAX];
+    const char* dirs[] = { "system", "system/xbin", "vendor", "vendor/lib", "data", "data/adb", "data/adb/su", "sbin" };
+    for (unsigned int i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        snprintf(path, PATH_MAX, "%s/%s", scratch, dirs[i]);
+        if (mkdir(path, 0755) != 0) return 1;
+    }
+    snprintf(path, PATH_MAX, "%s/system/xbin", scratch);
+    if (mount("tmpfs", path, "tmpfs", 0, "size=64k") != 0) return 1;
+    snprintf(path, PATH_MAX, "%s/vendor/lib", scratch);
+    if (mount("tmpfs", path, "tmpfs", 0, "size=64k") != 0) return 1;
+    char source[PATH_MAX];
+    snprintf(source, PATH_MAX, "%s/data/adb/su", scratch);
+    snprintf(path, PATH_MAX, "%s/sbin", scratch);
+    if (mount(source, path, NULL, MS_BIND, NULL) != 0) return 1;
+    return 0;
+}
+
+// count mounts below scratch in our namespace
+static int count_visible() {
+    FILE* file = fopen("/proc/self/mountinfo", "r");
+    if (file == NULL) return -1;
+    char line[4096];
+    char prefix[PATH_MAX];
+    snprintf(prefix, PATH_MAX, " %s/", scratch);
+    int count = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strstr(line, prefix) != NULL) count++;
+    }
+    fclose(file);
+    return count;
+}
+
+// app in its own copy of our namespace, waiting to be unmounted
+struct bench_app {
+    pid_t pid;
+    int go_fd;      // write to let it count its mounts
+    int result_fd;  // where it reports the count
+};
+
+static int start_app(struct bench_app* app) {
+    int go[2], result[2];
+    if (pipe(go) != 0) return 1;
+    if (pipe(result) != 0) {
+        close(go[0]);
+        close(go[1]);
+        return 1;
+    }
+    app->pid = fork();
+    if (app->pid == 0) {
+        close(go[1]);
+        close(result[0]);
+        int visible = -1;
+        char c;
+        if (unshare(CLONE_NEWNS) == 0) {
+            visible = 0;
+            if (write(result[1], &visible, sizeof(visible)) != sizeof(visible)) _exit(1);
+            if (read(go[0], &c, 1) == 1) visible = count_visible();
+        }
+        if (write(result[1], &visible, sizeof(visible)) != sizeof(visible)) _exit(1);
+        _exit(0);
+    }
+    close(go[0]);
+    close(result[1]);
+    app->go_fd = go[1];
+    app->result_fd = result[0];
+    int ready = -1;
+    if ((app->pid < 0) || (read(app->result_fd, &ready, sizeof(ready)) != sizeof(ready)) || (ready != 0)) {
+        close(app->go_fd);
+        close(app->result_fd);
+        if (app->pid > 0) waitpid(app->pid, NULL, 0);
+        return 1;
+    }
+    return 0;
+}
+
+// let app count its mounts and reap it, returns the count
+static int finish_app(struct bench_app* app) {
+    int visible = -1;
+    if ((write(app->go_fd, "", 1) != 1) || (read(app->result_fd, &visible, sizeof(visible)) != sizeof(visible))) visible = -1;
+    close(app->go_fd);
+    close(app->result_fd);
+    waitpid(app->pid, NULL, 0);
+    return visible;
+}
+
+static void bench_unmount(int count) {
+    if ((setup_mounts() != 0) || (unmount_init() != 0)) {
+        printf("unmount: cannot set up mounts (not root?)\n");
+        return;
+    }
+
+    // the tracer blocks SIGCHLD before starting any threads, see trace_init()
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    nsworker_start(NSWORKER_COUNT);
+
+    // what the tracer carried around when every unmount was a fork
+    memset(old_first_stop, 1, sizeof(old_first_stop));
+    memset(old_forked, 1, sizeof(old_forked));
+    memset(old_parent, 1, sizeof(old_parent));
+
+    struct proc_handle zygote;
+    proc_handle_open(&zygote, getpid());
+    struct rules* rules = rules_load();
+    struct plan* plan = plan_get(&zygote, rules);
+    printf("unmount: %d apps, %d mounts planned\n", count, plan != NULL ? plan->count : -1);
+
+    uint64_t* latency = (uint64_t*)calloc(count, sizeof(uint64_t));
+    if (latency == NULL) return;
+    for (int worker = 1; worker >= 0; worker--) {
+        // the helper exit()s, which would flush a copy of anything buffered here
+        fflush(stdout);
+        int done = 0, wrong = 0;
+        for (int i = 0; i < count; i++) {
+            struct bench_app app;
+            if (start_app(&app) != 0) {
+                wrong++;
+                continue;
+            }
+            struct proc_handle handle;
+            proc_handle_open(&handle, app.pid);
+
+            uint64_t start = monotonic_ns();
+            if (worker) {
+                struct nsworker_result result;
+                if (nsworker_submit(&zygote, &handle, rules, plan, i) == 0) {
+                    int status;
+                    while (!nsworker_collect(&result)) nsworker_waitpid(-1, &status, __WALL);
+                }
+            } else {
+                pid_t helper = unmount_root_async(&zygote, &handle, rules, plan);
+                if (helper > 0) waitpid(helper, NULL, 0);
+            }
+            latency[done++] = monotonic_ns() - start;
+
+            proc_handle_close(&handle);
+            if (finish_app(&app) != 0) wrong++;
+        }
+        report_latency(worker ? "namespace worker" : "forked helper", latency, done);
+        if (wrong > 0) printf("%-36s %10d apps\n", "  still had root mounts", wrong);
+    }
+    free(latency);
+
+    plan_release(plan);
+    rules_release(rules);
+    proc_handle_close(&zygote);
+    umount2(scratch, MNT_DETACH);
+    rmdir(scratch);
+}
+
+// --- mountinfo
+
+#define BENCH_PARSE_ROUNDS 20
+
+// write a synthetic mountinfo of lines lines to an unlinked temporary file, returns its fd or
+// -1. Most lines are APEX, bind and fuse mounts that no rule matches, some are root-related
+static int synthetic_mountinfo(int lines) {
+    char path[] = "/tmp/microbench.mountinfo.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return -1;
+    unlink(path);
+
+    FILE* file = fdopen(dup(fd), "w");
+    if (file == NULL) {
+        close(fd);
+        return -1;
+    }
+    for (int i = 0; i < lines; i++) {
+        int id = 100 + i;
+        int parent = (i < 16) ? 100 : 100 + (i % 16);
+        switch (i % 10) {
+            case 0: case 1: case 2:
+                fprintf(file, "%d %d 7:%d / /apex/com.android.module%d@%d ro,nodev,relatime master:%d - ext4 /dev/block/loop%d ro,seclabel\n",
+                    id, parent, i % 256, i, 300000000 + i, i, i);
+                break;
+            case 3: case 4:
+                fprintf(file, "%d %d 0:%d /media/%d /mnt/runtime/default/emulated/%d rw,nosuid,nodev,noexec,noatime shared:%d - fuse /dev/fuse rw,user_id=0,group_id=0\n",
+                    id, parent, 40 + i % 64, i, i, i);
+                break;
+            case 5:
+                fprintf(file, "%d %d 179:%d /data/app%d /mnt/media_rw/Card\\040%d rw,nosuid,nodev,noatime - vfat /dev/block/vold/public:179,%d rw,fmask=0002\n",
+                    id, parent, i % 64, i, i, i % 64);
+                break;
+            case 6:
+                fprintf(file, "%d %d 253:0 /etc/fake%d /system/etc/fake%d ro,relatime - ext4 /dev/block/dm-0 ro,seclabel\n",
+                    id, parent, i, i);
+                break;
+            case 7:
+                fprintf(file, "%d %d 0:%d / /sys/fs/cgroup/group%d rw,nosuid,nodev,noexec,relatime shared:%d - cgroup cgroup rw,memory\n",
+                    id, parent, 20 + i % 16, i, i);
+                break;
+            case 8:
+                fprintf(file, "%d %d 0:%d / /data/user/%d rw,nosuid,nodev,relatime - tmpfs tmpfs rw,seclabel,mode=751\n",
+                    id, parent, 30 + i % 16, i);
+                break;
+            case 9:
+                fprintf(file, "%d %d 259:%d /adb/su/bin /sbin/fake%d ro,relatime - ext4 /dev/block/sda%d ro,seclabel\n",
+                    id, parent, i % 32, i, i % 32);
+                break;
+        }
+    }
+    fclose(file);
+    return fd;
+}
+
+// the mountinfo loop of the old unmount_root(), see git history, without the matching.
+// Returns the number of lines parsed
+static int old_parse(int fd) {
+    char buf[32768];
+    int total = 0;
+    int size = 32768;
+    while (1) {
+        int r = read(fd, &buf[total], size - total);
+        if (r <= 0) break;
+        total += r;
+    }
+
+    int parsed = 0;
+    char* start = buf;
+    for (int i = 0; i < total; i++) {
+        if (buf[i] == '\n') {
+            buf[i] = '\0';
+
+            char p1[PATH_MAX];
+            char p2[PATH_MAX];
+            char p3[PATH_MAX];
+            char source[PATH_MAX];
+            char target[PATH_MAX];
+            char p6[PATH_MAX];
+            char p7[PATH_MAX];
+            char p8[PATH_MAX];
+            char fs[PATH_MAX];
+
+            if (sscanf(start, "%s %s %s %s %s %s %s %s %s", p1, p2, p3, source, target, p6, p7, p8, fs) == 9) {
+                sink += target[0] + source[0] + fs[0];
+                parsed++;
+            }
+
+            start = &buf[i + 1];
+        }
+    }
+    return parsed;
+}
+
+// the mountinfo reader as plan_build() and scan() use it, decoding targets with escapes only.
+// Returns the number of lines parsed
+static int new_parse(int fd) {
+    struct mountinfo_reader reader;
+    struct mountinfo_entry entry;
+    char decoded[PATH_MAX];
+    if (mountinfo_open(&reader, fd) != 0) return 0;
+    int parsed = 0;
+    while (mountinfo_next(&reader, &entry)) {
+        const char* target = mountinfo_decode(entry.target, decoded, sizeof(decoded));
+        sink += entry.id + entry.parent + target[0] + entry.root[0] + entry.fstype[0];
+        parsed++;
+    }
+    mountinfo_close(&reader);
+    return parsed;
+}
+
+static void bench_mountinfo_lines(int lines) {
+    int fd = synthetic_mountinfo(lines);
+    if (fd < 0) return;
+    printf("mountinfo: %d lines, %ld bytes\n", lines, (long)lseek(fd, 0, SEEK_END));
+
+    int parsed = 0;
+    uint64_t start = monotonic_ns();
+    for (int r = 0; r < BENCH_PARSE_ROUNDS; r++) {
+        lseek(fd, 0, SEEK_SET);
+        parsed = new_parse(fd);
+    }
+    uint64_t ns = monotonic_ns() - start;
+    report("mountinfo reader (per line)", (long)parsed * BENCH_PARSE_ROUNDS, ns);
+    printf("%-36s %10d lines  %10.1f us/file\n", "  parsed", parsed, ns / 1000.0 / BENCH_PARSE_ROUNDS);
+
+    start = monotonic_ns();
+    for (int r = 0; r < BENCH_PARSE_ROUNDS; r++) {
+        lseek(fd, 0, SEEK_SET);
+        parsed = old_parse(fd);
+    }
+    ns = monotonic_ns() - start;
+    report("old read + sscanf (per line)", (long)parsed * BENCH_PARSE_ROUNDS, ns);
+    printf("%-36s %10d lines  %10.1f us/file\n", "  parsed", parsed, ns / 1000.0 / BENCH_PARSE_ROUNDS);
+
+    close(fd);
+}
+
+static void bench_mountinfo(int lines) {
+    if (lines > 0) {
+        bench_mountinfo_lines(lines);
+    } else {
+        bench_mountinfo_lines(2000);
+        bench_mountinfo_lines(10000);
+    }
+}
+
+// --- rules
+
+// the matching of the old unmount_root(), see git history. Its source is the mount's root
+static int old_match(const char* source, const char* target, const char* fs) {
+    return
+        (strcmp(target, "/sbin") == 0) ||
+        (strncmp(target, "/sbin/", 6) == 0) ||
+        (strcmp(target, "/root/sbin") == 0) ||
+        (strncmp(target, "/root/sbin/", 11) == 0) ||
+        (strcmp(target, "/data/adb/su") == 0) ||
+        (strncmp(target, "/data/adb/su/", 13) == 0) ||
+        (strstr(source, "/adb/su") != NULL) ||
+        (strstr(target, "/system/") != NULL) ||
+        (strstr(target, "/vendor/") != NULL) ||
+        (strstr(target, "/original/") != NULL) ||
+        (
+            (
+                (strcmp(fs, "tmpfs") == 0)
+            ) && (
+                (strcmp(target, "/system") == 0) ||
+                (strcmp(target, "/vendor") == 0) ||
+                (strcmp(target, "/oem") == 0) ||
+                (strcmp(target, "/odm") == 0)
+            )
+        );
+}
+
+static void bench_rules(int lines) {
+    int fd = synthetic_mountinfo(lines);
+    struct mountinfo_entry* entries = (struct mountinfo_entry*)calloc(lines, sizeof(struct mountinfo_entry));
+    struct mountinfo_reader reader;
+    if ((fd < 0) || (entries == NULL) || (lseek(fd, 0, SEEK_SET) != 0) || (mountinfo_open(&reader, fd) != 0)) {
+        if (fd >= 0) close(fd);
+        free(entries);
+        return;
+    }
+
+    // keep copies, the reader's strings do not outlive the next line
+    int count = 0;
+    struct mountinfo_entry entry;
+    while ((count < lines) && mountinfo_next(&reader, &entry)) {
+        entries[count] = entry;
+        entries[count].root = strdup(entry.root);
+        entries[count].target = strdup(entry.target);
+        entries[count].fstype = strdup(entry.fstype);
+        entries[count].source = strdup(entry.source);
+        count++;
+    }
+    mountinfo_close(&reader);
+    close(fd);
+
+    struct rules* rules = rules_load();
+    printf("rules: %d lines, default rules\n", count);
+
+    int matched = 0;
+    uint64_t start = monotonic_ns();
+    for (int r = 0; r < BENCH_PARSE_ROUNDS; r++) {
+        matched = 0;
+        for (int i = 0; i < count; i++) matched += rules_match(rules, &entries[i]);
+    }
+    report("rules automaton (per line)", (long)count * BENCH_PARSE_ROUNDS, monotonic_ns() - start);
+    printf("%-36s %10d lines\n", "  matched", matched);
+
+    start = monotonic_ns();
+    for (int r = 0; r < BENCH_PARSE_ROUNDS; r++) {
+        matched = 0;
+        for (int i = 0; i < count; i++) matched += old_match(entries[i].root, entries[i].target, entries[i].fstype);
+    }
+    report("old strcmp chain (per line)", (long)count * BENCH_PARSE_ROUNDS, monotonic_ns() - start);
+    printf("%-36s %10d lines\n", "  matched", matched);
+
+    rules_release(rules);
+    for (int i = 0; i < count; i++) {
+        free(entries[i].root);
+        free(entries[i].target);
+        free(entries[i].fstype);
+        free(entries[i].source);
+    }
+    free(entries);
+}
+
+// --- policy
+
+#define BENCH_LOOKUPS 1000000
+
+#ifndef AID_USER
+#define AID_USER 100000
+#endif
+#ifndef AID_APP
+#define AID_APP 10000
+#endif
+
+// uid i of a hide list, spread over users 0 and 10
+static uid_t bench_uid(int i) {
+    return ((i % 4 == 3) ? 10 * AID_USER : 0) + AID_APP + 7 * i;
+}
+
+// the lookups of the old config.c, see git history
+static int old_allow_uid(const uid_t* uids, int uid_count, uid_t uid) {
+    if ((uid % AID_USER) < AID_APP) return 1;
+    if (uid_count == 0) return 1;
+    for (int i = 0; i < uid_count; i++) {
+        if (uids[i] == uid) return 0;
+    }
+    return 1;
+}
+
+static int old_allow_name(char** processes, int process_count, const char* name) {
+    if (process_count == 0) return 1;
+    for (int i = 0; i < process_count; i++) {
+        if (strcmp(processes[i], name) == 0) return 0;
+    }
+    return 1;
+}
+
+static void bench_policy_entries(int entries) {
+    // suhide.uid with entries uids and entries names, and the old config's arrays of them
+    size_t len = 0;
+    char* text = (char*)malloc((size_t)entries * 48 + 1);
+    uid_t* uids = (uid_t*)malloc(sizeof(uid_t) * entries);
+    char** processes = (char**)malloc(sizeof(char*) * entries);
+    if ((text == NULL) || (uids == NULL) || (processes == NULL)) {
+        free(text);
+        free(uids);
+        free(processes);
+        return;
+    }
+    for (int i = 0; i < entries; i++) {
+        uids[i] = bench_uid(i);
+        len += sprintf(&text[len], "%d\n", (int)uids[i]);
+        processes[i] = &text[len];
+        len += sprintf(&text[len], "com.fake.app%d\n", i);
+    }
+    char* copy = (char*)malloc(len + 1);
+    if (copy == NULL) {
+        free(text);
+        free(uids);
+        free(processes);
+        return;
+    }
+    memcpy(copy, text, len);
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == '\n') text[i] = '\0';
+    }
+
+    uint64_t start = monotonic_ns();
+    struct policy* policy = policy_compile(copy, len, 0);
+    uint64_t compile_ns = monotonic_ns() - start;
+    free(copy);
+    if (policy == NULL) {
+        free(text);
+        free(uids);
+        free(processes);
+        return;
+    }
+    printf("policy: %d uids and %d names, compiled to %u bytes in %.1f us\n", entries, entries,
+        policy->size, compile_ns / 1000.0);
+
+    // half of the lookups hit the list, half are apps not on it
+    char names[64][32];
+    uid_t queries[64];
+    for (int i = 0; i < 64; i++) {
+        int entry = (int)(((long)i * 7919) % entries);
+        queries[i] = (i % 2 == 0) ? bench_uid(entry) : bench_uid(entry) + 1;
+        snprintf(names[i], sizeof(names[i]), (i % 2 == 0) ? "com.fake.app%d" : "com.other.app%d", entry);
+    }
+
+    int denied = 0;
+    start = monotonic_ns();
+    for (int i = 0; i < BENCH_LOOKUPS; i++) denied += !policy_allow_uid(policy, policy->size, queries[i & 63]);
+    report("policy uid", BENCH_LOOKUPS, monotonic_ns() - start);
+    start = monotonic_ns();
+    for (int i = 0; i < BENCH_LOOKUPS; i++) denied += !policy_allow_name(policy, policy->size, names[i & 63]);
+    report("policy name", BENCH_LOOKUPS, monotonic_ns() - start);
+    printf("%-36s %10d\n", "  denied", denied);
+
+    // the old scans are slow enough with long lists to need fewer rounds
+    int lookups = BENCH_LOOKUPS / (entries > 100 ? entries / 100 : 1);
+    denied = 0;
+    start = monotonic_ns();
+    for (int i = 0; i < lookups; i++) denied += !old_allow_uid(uids, entries, queries[i & 63]);
+    report("old uid scan", lookups, monotonic_ns() - start);
+    start = monotonic_ns();
+    for (int i = 0; i < lookups; i++) denied += !old_allow_name(processes, entries, names[i & 63]);
+    report("old name scan", lookups, monotonic_ns() - start);
+    printf("%-36s %10d\n", "  denied", denied);
+
+    free(policy);
+    free(text);
+    free(uids);
+    free(processes);
+}
+
+static void bench_policy(int entries) {
+    if (entries > 0) {
+        bench_policy_entries(entries);
+    } else {
+        bench_policy_entries(5);
+        bench_policy_entries(500);
+        bench_policy_entries(5000);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int count = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n': count = atoi(optarg); break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if ((optind != argc - 1) || (count < 0)) {
+        fprintf(stderr, "Usage: %s [-n count] pidtable|unmount|mountinfo|rules|policy\n", argv[0]);
+        return 1;
+    }
+
+    const char* mode = argv[optind];
+    if (strcmp(mode, "pidtable") == 0) {
+        bench_pidtable(count > 0 ? count : 10000);
+    } else if (strcmp(mode, "unmount") == 0) {
+        bench_unmount(count > 0 ? count : 1000);
+    } else if (strcmp(mode, "mountinfo") == 0) {
+        bench_mountinfo(count);
+    } else if (strcmp(mode, "rules") == 0) {
+        bench_rules(count > 0 ? count : 2000);
+    } else if (strcmp(mode, "policy") == 0) {
+        bench_policy(count);
+    } else {
+        fprintf(stderr, "Unknown mode [%s]\n", mode);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,562 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* suhide_replay feeds a recording of the ptrace backend's inputs (see record.h) through the
+ * tracer's own state machine on a workstation, to benchmark it and to bisect behaviour
+ * changes with sessions captured on real devices.
+ *
+ * To record on a device, create the recording file before the tracer starts, for example
+ * touch /dev/.suhide64.record, and restart zygote (or the device). Pull the file afterwards.
+ *
+ * The replay is built from suhide.c itself, its main() renamed, with ptrace, /proc, the
+ * unmount workers, stats and the event log replaced by the stubs below, which return what
+ * was recorded instead. Nothing is traced, signaled or unmounted. If the state machine asks
+ * for something other than what comes next in the recording, its behaviour has diverged from
+ * the build that made the recording, and the replay stops there.
+ *
+ * What the state machine does in response (ptrace requests, detaches, signals and event log
+ * records) is summarized and hashed into a digest, so two builds can be compared quickly;
+ * -v prints each of these actions to compare them in detail. Package decisions depend on the
+ * policy, pass the one used on the device with -p.
+ *
+ * Build on a host from suhide/native with:
+ *
+ *     cc -std=gnu11 -D_GNU_SOURCE -O2 -Ihost -I. -DLOG_TAG=\"suhide_replay\" -Dmain=suhide_main \
+ *         -o suhide_replay host/replay.c suhide.c record.c pidtable.c util.c config.c policy.c \
+ *         sharedpolicy.c procconn.c -lpthread
+ *
+ * and run, for example:
+ *
+ *     ./suhide_replay -n 100 -p suhide.uid suhide64.record
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "util.h"
+#include "record.h"
+#include "trace.h"
+#include "nsworker.h"
+#include "unmount.h"
+#include "rules.h"
+#include "plan.h"
+#include "prochandle.h"
+#include "package.h"
+#include "stats.h"
+#include "eventlog.h"
+#include "policy.h"
+#include "sharedpolicy.h"
+
+// the build renames suhide.c's main(), but not ours
+#undef main
+int suhide_main(int argc, char *argv[], char** envp);
+
+// outcome of a single replay, passed from the replaying child to the parent
+struct replay {
+    uint64_t time;          // ns spent in suhide_main()
+    int consumed;           // records replayed
+    int diverged;           // record index the state machine diverged at, or -1
+    uint64_t digest;        // FNV-1a over all actions
+    int events[EVENTLOG_TYPES];
+};
+
+static const char* type_names[RECORD_TYPES] = { "?", "WAIT", "EVENTMSG", "PACKAGE", "SUBMIT", "COLLECT" };
+
+// recording, read into memory as a whole
+static char* data = NULL;
+static size_t data_size = 0;
+static char targets[64] = "";
+static pid_t target = 0;    // first zygote
+static uint32_t flags = 0;
+static int total = 0;
+
+// replay state, only touched by the replaying child
+static size_t offset = sizeof(struct record_header);
+static struct replay replay;
+static int verbose = 0;
+
+// next record, or NULL at the end of the recording or at a truncated record
+static const struct record* peek() {
+    if (offset + sizeof(struct record) > data_size) return NULL;
+    const struct record* record = (const struct record*)&data[offset];
+    if ((record->type == 0) || (record->type >= RECORD_TYPES)) return NULL;
+    if (offset + sizeof(struct record) + record->len > data_size) return NULL;
+    return record;
+}
+
+static void consume(const struct record* record) {
+    offset += sizeof(struct record) + record->len;
+    replay.consumed++;
+}
+
+// report divergence and end the replay
+static void diverge(int type, pid_t pid) {
+    const struct record* record = peek();
+    if (record != NULL) {
+        fprintf(stderr, "diverged at record %d: asked for %s [%d], recorded %s [%d]\n", replay.consumed, type_names[type], pid, type_names[record->type], record->pid);
+    } else {
+        fprintf(stderr, "diverged at record %d: asked for %s [%d], recording ended\n", replay.consumed, type_names[type], pid);
+    }
+    replay.diverged = replay.consumed;
+    exit(0);
+}
+
+// consume the next record, which must be of type and for pid
+static const struct record* expect(int type, pid_t pid) {
+    const struct record* record = peek();
+    if ((record == NULL) || (record->type != type) || (record->pid != pid)) diverge(type, pid);
+    consume(record);
+    return record;
+}
+
+// add an action of the state machine to the digest
+static void action(const char* name, int64_t a, int64_t b, int64_t c, int64_t d) {
+    int64_t values[4] = { a, b, c, d };
+    for (const char* p = name; *p != '\0'; p++) {
+        replay.digest = (replay.digest ^ (unsigned char)*p) * 0x100000001b3ULL;
+    }
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 8; j++) {
+            replay.digest = (replay.digest ^ ((uint64_t)values[i] >> (j * 8) & 0xff)) * 0x100000001b3ULL;
+        }
+    }
+    if (verbose) printf("%6d %-12s %8lld %8lld %8lld %8lld\n", replay.consumed, name, (long long)a, (long long)b, (long long)c, (long long)d);
+}
+
+// trace.c
+
+void trace_init() {
+}
+
+long trace(int request, pid_t pid, void *addr, size_t data) {
+    (void)addr;
+    if (request == PTRACE_GETEVENTMSG) {
+        *(unsigned long*)data = (unsigned long)expect(RECORD_EVENTMSG, pid)->value;
+        return 0;
+    }
+    action("trace", request, pid, data, 0);
+    return 0;
+}
+
+int cont(pid_t group, pid_t target) {
+    action("cont", group, target, 0, 0);
+    return 0;
+}
+
+int stop(pid_t group, pid_t target) {
+    action("stop", group, target, 0, 0);
+    return 0;
+}
+
+void wait_stop(pid_t target) {
+    action("wait_stop", target, 0, 0, 0);
+}
+
+int stop_and_wait_stop(pid_t group, pid_t target) {
+    action("stop_wait", group, target, 0, 0);
+    return 0;
+}
+
+int stop_and_detach(pid_t group, pid_t target) {
+    action("stop_detach", group, target, 0, 0);
+    return 0;
+}
+
+void detach_pid(int pid, int procfd) {
+    (void)procfd;
+    action("detach_pid", pid, 0, 0, 0);
+}
+
+void detach_seized(int pid, int procfd) {
+    (void)procfd;
+    action("detach_seized", pid, 0, 0, 0);
+}
+
+// nsworker.c
+
+int nsworker_start(int count) {
+    (void)count;
+    return 0;
+}
+
+int nsworker_submit(const struct proc_handle* zygote, const struct proc_handle* app, struct rules* rules, struct plan* plan, unsigned int cookie) {
+    (void)zygote; (void)rules; (void)plan;
+    const struct record* record = peek();
+    if ((record == NULL) || (record->type != RECORD_SUBMIT) || (record->pid != app->pid)) diverge(RECORD_SUBMIT, app->pid);
+    action("submit", app->pid, cookie, record->value, 0);
+    if (record->value != 0) return 1; // went to a helper, see unmount_root_async()
+    consume(record);
+    return 0;
+}
+
+int nsworker_fd() {
+    return -1;
+}
+
+int nsworker_collect(struct nsworker_result* result) {
+    const struct record* record = peek();
+    if ((record == NULL) || (record->type != RECORD_COLLECT) || (record->len < sizeof(struct record_unmount))) return 0;
+    consume(record);
+
+    struct record_unmount unmount;
+    memcpy(&unmount, (const char*)record + sizeof(struct record), sizeof(unmount));
+    memset(result, 0, sizeof(struct nsworker_result));
+    result->pid = record->pid;
+    result->cookie = (unsigned int)record->value;
+    result->result.unmounted = unmount.unmounted;
+    result->result.failed = unmount.failed;
+    result->result.skipped = unmount.skipped;
+    return 1;
+}
+
+pid_t nsworker_waitpid(pid_t pid, int* status, int options) {
+    (void)pid; (void)options;
+    const struct record* record = peek();
+    if (record == NULL) {
+        // recording was cut short, end as if a zygote died
+        *status = 0;
+        return target;
+    }
+    if (record->type == RECORD_COLLECT) {
+        // a worker completed a job while we were waiting
+        errno = EINTR;
+        return -1;
+    }
+    record = expect(RECORD_WAIT, record->pid);
+    *status = (int)record->value;
+    return record->pid;
+}
+
+// unmount.c, rules.c, plan.c
+
+int unmount_init() {
+    return 0;
+}
+
+int unmount_root(const struct proc_handle* zygote, const struct proc_handle* app, const struct rules* rules, const struct plan* plan, struct unmount_result* result) {
+    (void)zygote; (void)app; (void)rules; (void)plan;
+    memset(result, 0, sizeof(struct unmount_result));
+    return 0;
+}
+
+pid_t unmount_root_async(const struct proc_handle* zygote, const struct proc_handle* app, const struct rules* rules, const struct plan* plan) {
+    (void)zygote; (void)rules; (void)plan;
+    return (pid_t)expect(RECORD_SUBMIT, app->pid)->value;
+}
+
+struct rules* rules_load() {
+    return NULL;
+}
+
+void rules_release(struct rules* rules) {
+    (void)rules;
+}
+
+void rules_watched() {
+}
+
+void rules_reload() {
+}
+
+struct plan* plan_get(const struct proc_handle* zygote, struct rules* rules) {
+    (void)zygote; (void)rules;
+    return NULL;
+}
+
+void plan_release(struct plan* plan) {
+    (void)plan;
+}
+
+void plan_forget(const struct proc_handle* zygote) {
+    (void)zygote;
+}
+
+// prochandle.c, nothing here may touch a real process
+
+void proc_handle_init(struct proc_handle* handle, pid_t pid) {
+    handle->pid = pid;
+    handle->pidfd = -1;
+    handle->procfd = -1;
+}
+
+void proc_handle_open(struct proc_handle* handle, pid_t pid) {
+    proc_handle_init(handle, pid);
+}
+
+void proc_handle_dup(struct proc_handle* dst, const struct proc_handle* src) {
+    proc_handle_init(dst, src->pid);
+}
+
+void proc_handle_close(struct proc_handle* handle) {
+    handle->pid = 0;
+}
+
+int proc_handle_alive(const struct proc_handle* handle) {
+    (void)handle;
+    return 1;
+}
+
+void proc_handle_exited(const struct proc_handle* const* handles, int count, unsigned char* exited) {
+    (void)handles;
+    memset(exited, 0, count);
+}
+
+int proc_handle_kill(const struct proc_handle* handle, int signal) {
+    action("kill", handle->pid, signal, 0, 0);
+    return 0;
+}
+
+int proc_openat(const struct proc_handle* handle, const char* name, int flags) {
+    (void)handle; (void)name; (void)flags;
+    errno = ENOENT;
+    return -1;
+}
+
+int proc_fstatat(const struct proc_handle* handle, const char* name, struct stat* st) {
+    (void)handle; (void)name; (void)st;
+    errno = ENOENT;
+    return -1;
+}
+
+ssize_t proc_readlinkat(const struct proc_handle* handle, const char* name, char* buf, size_t size) {
+    (void)handle; (void)name; (void)buf; (void)size;
+    errno = ENOENT;
+    return -1;
+}
+
+int proc_setns_mnt(const struct proc_handle* handle) {
+    (void)handle;
+    errno = ENOENT;
+    return -1;
+}
+
+// package.c
+
+uint32_t package_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name != '\0') {
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+int detect_package(const struct proc_handle* proc, uint32_t inherited, char* cmdline, uid_t* uid) {
+    (void)inherited;
+    const struct record* record = expect(RECORD_PACKAGE, proc->pid);
+    if (record->value < 0) return 0;
+    *uid = (uid_t)record->value;
+    size_t len = record->len < 128 ? record->len : 127;
+    memcpy(cmdline, (const char*)record + sizeof(struct record), len);
+    cmdline[len] = '\0';
+    return 1;
+}
+
+// stats.c, eventlog.c
+
+int stats_open(const char* path) {
+    (void)path;
+    return 0;
+}
+
+void stats_add(int counter, uint64_t value) {
+    (void)counter; (void)value;
+}
+
+void stats_set(int counter, uint64_t value) {
+    (void)counter; (void)value;
+}
+
+void stats_record(int histogram, uint64_t start, uint64_t end) {
+    (void)histogram; (void)start; (void)end;
+}
+
+int eventlog_open(const char* path) {
+    (void)path;
+    return 0;
+}
+
+void eventlog_write(int type, pid_t pid, int event, int decision, int err, int arg) {
+    if ((type > 0) && (type < EVENTLOG_TYPES)) replay.events[type]++;
+    action("event", type, pid, (event << 8) | decision, arg);
+    (void)err;
+}
+
+// write the outcome to the parent when suhide_main() returns, or diverge() exits
+static int result_fd = -1;
+static uint64_t replay_started = 0;
+
+static void report() {
+    replay.time = monotonic_ns() - replay_started;
+    if (write(result_fd, &replay, sizeof(replay)) != sizeof(replay)) _exit(1);
+}
+
+// replay the recording once in a fresh process, returns 0 on success
+static int run(int policy_fd, int print, struct replay* result) {
+    int fds[2];
+    if (pipe(fds) != 0) return 1;
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        result_fd = fds[1];
+        verbose = print;
+        replay.diverged = -1;
+        replay.digest = 0xcbf29ce484222325ULL;
+        atexit(report);
+
+        // writable, prettify() overwrites these
+        char args[4][64];
+        snprintf(args[0], sizeof(args[0]), "suhide_replay");
+        snprintf(args[1], sizeof(args[1]), "%s", targets);
+        snprintf(args[2], sizeof(args[2]), (flags & RECORD_SEIZED) ? "seize" : "ptrace");
+        snprintf(args[3], sizeof(args[3]), "%d", policy_fd);
+        char* argv[5] = { args[0], args[1], args[2], args[3], NULL };
+
+        replay_started = monotonic_ns();
+        exit(suhide_main(4, argv, NULL));
+    }
+    close(fds[1]);
+    if (child < 0) {
+        close(fds[0]);
+        return 1;
+    }
+    int ok = read(fds[0], result, sizeof(struct replay)) == sizeof(struct replay);
+    close(fds[0]);
+    waitpid(child, NULL, 0);
+    return ok ? 0 : 1;
+}
+
+// read a whole file, returns NULL on failure. The buffer has room for a terminating byte
+static char* read_file(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat stat;
+    char* buf = NULL;
+    if ((fstat(fd, &stat) == 0) && ((buf = (char*)malloc(stat.st_size + 1)) != NULL)) {
+        size_t done = 0;
+        while (done < (size_t)stat.st_size) {
+            ssize_t r = read(fd, &buf[done], stat.st_size - done);
+            if (r <= 0) break;
+            done += r;
+        }
+        *size = done;
+    }
+    close(fd);
+    return buf;
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = 1;
+    char* policy_path = NULL;
+    int print = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:v")) != -1) {
+        switch (opt) {
+            case 'n': iterations = atoi(optarg); break;
+            case 'p': policy_path = optarg; break;
+            case 'v': print = 1; break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if ((optind != argc - 1) || (iterations <= 0)) {
+        fprintf(stderr, "Usage: %s [-n iterations] [-p policy] [-v] <recording>\n", argv[0]);
+        return 1;
+    }
+
+    data = read_file(argv[optind], &data_size);
+    const struct record_header* header = (const struct record_header*)data;
+    if ((data == NULL) || (data_size < sizeof(struct record_header)) || (header->magic != RECORD_MAGIC) || (header->version != RECORD_VERSION)) {
+        fprintf(stderr, "%s: not a recording\n", argv[optind]);
+        return 1;
+    }
+    if ((header->count == 0) || (header->count > RECORD_TARGETS)) {
+        fprintf(stderr, "%s: no zygotes recorded\n", argv[optind]);
+        return 1;
+    }
+    target = header->targets[0];
+    for (unsigned int i = 0, len = 0; i < header->count; i++) {
+        len += snprintf(&targets[len], sizeof(targets) - len, i == 0 ? "%d" : ",%d", header->targets[i]);
+    }
+    flags = header->flags;
+    uint64_t duration = 0;
+    for (const struct record* record; (record = peek()) != NULL; offset += sizeof(struct record) + record->len) {
+        duration = record->time;
+        total++;
+    }
+    offset = sizeof(struct record_header);
+
+    // share the policy like the launcher does, so nothing is loaded from this host's filesystem
+    size_t policy_size = 0;
+    char empty[1];
+    char* text = (policy_path != NULL) ? read_file(policy_path, &policy_size) : empty;
+    struct policy* policy = (text != NULL) ? policy_compile(text, policy_size, 1) : NULL;
+    int policy_fd = sharedpolicy_create();
+    if ((policy == NULL) || (policy_fd < 0) || (sharedpolicy_publish(policy) != 0)) {
+        fprintf(stderr, "failed to load policy\n");
+        return 1;
+    }
+    free(policy);
+
+    printf("recording: %d records, zygotes [%s], %.3f s\n", total, targets, duration / 1e9);
+
+    uint64_t* times = (uint64_t*)calloc(iterations, sizeof(uint64_t));
+    struct replay first, result;
+    if ((times == NULL) || (run(policy_fd, print, &first) != 0)) {
+        fprintf(stderr, "replay failed\n");
+        return 1;
+    }
+    times[0] = first.time;
+    int consistent = 1;
+    for (int i = 1; i < iterations; i++) {
+        if (run(policy_fd, 0, &result) != 0) {
+            fprintf(stderr, "replay failed\n");
+            return 1;
+        }
+        times[i] = result.time;
+        if ((result.digest != first.digest) || (result.consumed != first.consumed)) consistent = 0;
+    }
+    qsort(times, iterations, sizeof(uint64_t), compare_u64);
+
+    if (first.diverged >= 0) {
+        printf("replay: diverged at record %d of %d\n", first.diverged, total);
+    } else if (first.consumed != total) {
+        printf("replay: zygote exited at record %d of %d\n", first.consumed, total);
+    }
+    printf("replay: %d records, best %.1f us, median %.1f us, %.2f M records/s\n",
+        first.consumed, times[0] / 1000.0, times[iterations / 2] / 1000.0,
+        times[iterations / 2] > 0 ? first.consumed * 1000.0 / times[iterations / 2] : 0.0);
+    printf("forks %d, clones %d, detected %d, unmounts %d, detached %d, exits %d\n",
+        first.events[EVENTLOG_FORK], first.events[EVENTLOG_CLONE], first.events[EVENTLOG_DETECT],
+        first.events[EVENTLOG_UNMOUNT_START], first.events[EVENTLOG_DETACH], first.events[EVENTLOG_EXIT]);
+    printf("digest %016llx%s\n", (unsigned long long)first.digest, consistent ? "" : " (not deterministic!)");
+    free(times);
+    return (first.diverged >= 0) || !consistent ? 2 : 0;
+}
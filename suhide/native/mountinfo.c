@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Streaming /proc/<pid>/mountinfo tokenizer. The file is read in chunks into a buffer that
+ * only grows when a single line does not fit, so there is no limit on the total size of the
+ * mount table, and fields are split in place rather than copied.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "mountinfo.h"
+
+#define MOUNTINFO_CHUNK 4096
+
+// start reading mountinfo from fd, which stays owned by the caller. Returns 0 on success
+int mountinfo_open(struct mountinfo_reader* reader, int fd) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+    reader->size = MOUNTINFO_CHUNK;
+    reader->buf = (char*)malloc(reader->size);
+    return reader->buf != NULL ? 0 : 1;
+}
+
+// release the reader's buffer
+void mountinfo_close(struct mountinfo_reader* reader) {
+    free(reader->buf);
+    reader->buf = NULL;
+}
+
+// split the next space-separated field off *line in place, returns NULL if there is none
+static char* next_field(char** line) {
+    char* start = *line;
+    if (*start == '\0') return NULL;
+    char* end = strchr(start, ' ');
+    if (end != NULL) {
+        *end = '\0';
+        *line = end + 1;
+    } else {
+        *line = start + strlen(start);
+    }
+    return start;
+}
+
+// parse a single NUL terminated line into entry, returns 0 on success
+static int parse_line(char* line, struct mountinfo_entry* entry) {
+    char* id = next_field(&line);
+    char* parent = next_field(&line);
+    char* devno = next_field(&line);
+    entry->root = next_field(&line);
+    entry->target = next_field(&line);
+    char* options = next_field(&line);
+    if ((id == NULL) || (parent == NULL) || (devno == NULL) || (entry->root == NULL) || (entry->target == NULL) || (options == NULL)) return 1;
+
+    // optional fields are terminated by a single hyphen
+    char* field;
+    while (((field = next_field(&line)) != NULL) && (strcmp(field, "-") != 0));
+    if (field == NULL) return 1;
+
+    entry->fstype = next_field(&line);
+    entry->source = next_field(&line);
+    if ((entry->fstype == NULL) || (entry->source == NULL)) return 1;
+
+    entry->id = atoi(id);
+    entry->parent = atoi(parent);
+    return 0;
+}
+
+// get the next mount, returns 1 if entry was filled, 0 at end of file, -1 on read error or
+// allocation failure. Malformed lines are skipped
+int mountinfo_next(struct mountinfo_reader* reader, struct mountinfo_entry* entry) {
+    while (1) {
+        char* start = &reader->buf[reader->pos];
+        char* newline = memchr(start, '\n', reader->len - reader->pos);
+        if ((newline == NULL) && reader->eof) {
+            if (reader->pos == reader->len) return 0;
+            // last line without newline, there is always room for the terminator
+            newline = &reader->buf[reader->len];
+            reader->len++;
+        }
+
+        if (newline != NULL) {
+            *newline = '\0';
+            reader->pos = newline - reader->buf + 1;
+            if (parse_line(start, entry) == 0) return 1;
+            continue;
+        }
+
+        // need more data: move the partial line to the front, grow if it fills the buffer
+        if (reader->pos > 0) {
+            memmove(reader->buf, start, reader->len - reader->pos);
+            reader->len -= reader->pos;
+            reader->pos = 0;
+        }
+        if (reader->len + 1 >= reader->size) {
+            char* buf = (char*)realloc(reader->buf, reader->size * 2);
+            if (buf == NULL) return -1;
+            reader->buf = buf;
+            reader->size *= 2;
+        }
+
+        // keep one byte free for the terminator of an unterminated last line
+        ssize_t r = read(reader->fd, &reader->buf[reader->len], reader->size - reader->len - 1);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (r == 0) reader->eof = 1;
+        reader->len += r;
+    }
+}
+
+// decode octal escapes (\040 for space, etc) in field into buf. Returns field itself if it
+// contains no escapes, buf otherwise
+const char* mountinfo_decode(const char* field, char* buf, size_t size) {
+    if (strchr(field, '\\') == NULL) return field;
+
+    size_t out = 0;
+    for (const char* in = field; (*in != '\0') && (out < size - 1); in++) {
+        if ((in[0] == '\\') &&
+            (in[1] >= '0') && (in[1] <= '3') &&
+            (in[2] >= '0') && (in[2] <= '7') &&
+            (in[3] >= '0') && (in[3] <= '7')) {
+            buf[out++] = (char)(((in[1] - '0') << 6) | ((in[2] - '0') << 3) | (in[3] - '0'));
+            in += 3;
+        } else {
+            buf[out++] = *in;
+        }
+    }
+    buf[out] = '\0';
+    return buf;
+}
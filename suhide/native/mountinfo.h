@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _MOUNTINFO_H
+#define _MOUNTINFO_H
+
+#include <sys/types.h>
+
+// single line of /proc/<pid>/mountinfo. Strings point into the reader's buffer, are NUL
+// terminated, still contain octal escapes (see mountinfo_decode()), and are only valid until
+// the next mountinfo_next() call
+struct mountinfo_entry {
+    int id;
+    int parent;
+    char* root;     // root of the mount within its filesystem (bind mount source)
+    char* target;   // mount point
+    char* fstype;
+    char* source;   // mount source (device)
+};
+
+// streaming reader state
+struct mountinfo_reader {
+    int fd;
+    char* buf;
+    size_t size;
+    size_t pos;
+    size_t len;
+    int eof;
+};
+
+int mountinfo_open(struct mountinfo_reader* reader, int fd);
+int mountinfo_next(struct mountinfo_reader* reader, struct mountinfo_entry* entry);
+void mountinfo_close(struct mountinfo_reader* reader);
+const char* mountinfo_decode(const char* field, char* buf, size_t size);
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Pool of pre-spawned namespace worker threads, so unmounting an app's namespace does not
+ * require a fork() of the tracer at launch time. Each worker unshares its filesystem context
+ * so it may setns(CLONE_NEWNS) into the app's namespace and back.
+ *
+ * The owner thread spends its time waiting for its children in nsworker_waitpid(), which
+ * polls an eventfd that workers signal completed jobs on, together with a signalfd for
+ * SIGCHLD (blocked by trace_init()). Both stay readable until drained, so neither a result nor
+ * a child state change that arrives just before the owner goes to sleep can be missed.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+#include "ndklog.h"
+#include "nsworker.h"
+
+#define NSWORKER_QUEUE 64
+
+// queued unmount job
+struct nsworker_job {
+    struct proc_handle zygote; // owned by the job
+    struct proc_handle app; // owned by the job
+    struct rules* rules; // reference owned by the job
+    struct plan* plan; // reference owned by the job, may be NULL
+    unsigned int cookie;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t started = PTHREAD_COND_INITIALIZER;
+
+static struct nsworker_job jobs[NSWORKER_QUEUE];
+static int job_head = 0;
+static int job_count = 0;
+
+static struct nsworker_result results[NSWORKER_QUEUE];
+static int result_head = 0;
+static int result_count = 0;
+
+static int in_flight = 0; // submitted but not yet collected
+static int workers = 0; // usable workers
+static int starting = 0; // workers that have not yet reported in
+static int result_fd = -1; // eventfd, signaled for every completed job
+static int sigchld_fd = -1; // signalfd for SIGCHLD
+
+static void* worker_main(void* arg) {
+    (void)arg;
+
+    int ok = (unshare(CLONE_FS) == 0);
+    pthread_mutex_lock(&lock);
+    if (ok) workers++;
+    starting--;
+    pthread_cond_broadcast(&started);
+    if (!ok) {
+        LOGD("nsworker: unshare failed [%d]", errno);
+        pthread_mutex_unlock(&lock);
+        return NULL;
+    }
+
+    while (1) {
+        while (job_count == 0) pthread_cond_wait(&job_ready, &lock);
+        struct nsworker_job job = jobs[job_head];
+        job_head = (job_head + 1) % NSWORKER_QUEUE;
+        job_count--;
+        pthread_mutex_unlock(&lock);
+
+        struct nsworker_result result;
+        result.pid = job.app.pid;
+        result.cookie = job.cookie;
+        int broken = unmount_root(&job.zygote, &job.app, job.rules, job.plan, &result.result);
+        proc_handle_close(&job.zygote);
+        proc_handle_close(&job.app);
+        rules_release(job.rules);
+        plan_release(job.plan);
+
+        pthread_mutex_lock(&lock);
+        results[(result_head + result_count) % NSWORKER_QUEUE] = result;
+        result_count++;
+        uint64_t one = 1;
+        write(result_fd, &one, sizeof(one));
+
+        if (broken) {
+            // stuck in the app's namespace, retire this worker
+            workers--;
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+    }
+}
+
+// start count workers owned by the calling thread, which must be the thread that calls
+// nsworker_collect() and nsworker_waitpid(). SIGCHLD must be blocked in all threads, threads
+// started before this must block it themselves. Returns the number of usable workers
+int nsworker_start(int count) {
+    if (unmount_init() != 0) return 0;
+
+    // blocked before creating threads so they inherit it, normally done by trace_init() already
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    result_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    sigchld_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if ((result_fd < 0) || (sigchld_fd < 0)) {
+        // without them we could not wake the owner, nsworker_waitpid() is a plain waitpid()
+        LOGD("nsworker: eventfd/signalfd failed [%d]", errno);
+        if (result_fd >= 0) close(result_fd);
+        if (sigchld_fd >= 0) close(sigchld_fd);
+        result_fd = sigchld_fd = -1;
+        return 0;
+    }
+
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < count; i++) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        pthread_attr_setstacksize(&attr, 128 * 1024);
+        if (pthread_create(&thread, &attr, worker_main, NULL) == 0) starting++;
+        pthread_attr_destroy(&attr);
+    }
+    while (starting > 0) pthread_cond_wait(&started, &lock);
+    int ret = workers;
+    pthread_mutex_unlock(&lock);
+
+    LOGD("nsworker: %d workers", ret);
+    return ret;
+}
+
+// queue unmounting of app's namespace, cookie is passed back in the result. The job takes
+// its own copies of zygote's and app's fds and its own references to rules and plan, so either
+// may exit or be removed from the pidtable before the job runs.
+// Returns 0 if queued, 1 if no worker is available or the queue is full
+int nsworker_submit(const struct proc_handle* zygote, const struct proc_handle* app, struct rules* rules, struct plan* plan, unsigned int cookie) {
+    int ret = 1;
+    pthread_mutex_lock(&lock);
+    if ((workers > 0) && (in_flight < NSWORKER_QUEUE)) {
+        struct nsworker_job* job = &jobs[(job_head + job_count) % NSWORKER_QUEUE];
+        proc_handle_dup(&job->zygote, zygote);
+        proc_handle_dup(&job->app, app);
+        job->rules = rules;
+        if (rules != NULL) rules_acquire(rules);
+        job->plan = plan;
+        if (plan != NULL) plan_acquire(plan);
+        job->cookie = cookie;
+        job_count++;
+        in_flight++;
+        pthread_cond_signal(&job_ready);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+// eventfd that becomes readable when a job completes, for owners that poll() on other fds rather
+// than waiting in nsworker_waitpid(). They must read it before calling nsworker_collect()
+int nsworker_fd() {
+    return result_fd;
+}
+
+// get a completed job without blocking, returns 1 if result was filled, 0 if none are available
+int nsworker_collect(struct nsworker_result* result) {
+    int ret = 0;
+    pthread_mutex_lock(&lock);
+    if (result_count > 0) {
+        *result = results[result_head];
+        result_head = (result_head + 1) % NSWORKER_QUEUE;
+        result_count--;
+        in_flight--;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+// waitpid() that returns -1 with EINTR when a worker has completed a job
+pid_t nsworker_waitpid(pid_t pid, int* status, int options) {
+    if (sigchld_fd < 0) return waitpid(pid, status, options);
+
+    while (1) {
+        // drain before checking, so any later state change makes sigchld_fd readable again
+        struct signalfd_siginfo info;
+        while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info));
+
+        pid_t ret = waitpid(pid, status, options | WNOHANG);
+        if ((ret != 0) || (options & WNOHANG)) return ret;
+
+        struct pollfd fds[2] = { { result_fd, POLLIN, 0 }, { sigchld_fd, POLLIN, 0 } };
+        if ((poll(fds, 2, -1) < 0) && (errno != EINTR)) return -1;
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            read(result_fd, &count, sizeof(count));
+            errno = EINTR;
+            return -1;
+        }
+    }
+}
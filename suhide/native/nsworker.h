@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _NSWORKER_H
+#define _NSWORKER_H
+
+#include <sys/types.h>
+
+#include "unmount.h"
+
+#define NSWORKER_COUNT 2
+
+// completed unmount job
+struct nsworker_result {
+    pid_t pid;
+    unsigned int cookie;
+    struct unmount_result result;
+};
+
+int nsworker_start(int count);
+int nsworker_submit(const struct proc_handle* zygote, const struct proc_handle* app, struct rules* rules, struct plan* plan, unsigned int cookie);
+int nsworker_fd();
+int nsworker_collect(struct nsworker_result* result);
+pid_t nsworker_waitpid(pid_t pid, int* status, int options);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "prochandle.h"
+#include "record.h"
+#include "package.h"
+
+// FNV-1a of a process name, never 0
+uint32_t package_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name != '\0') {
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+// reads the owner uid and process name of a process (that has been forked/cloned from zygote) into
+// uid and cmdline (128 bytes), returns 1 if the name has changed to its final form (usually
+// based on package name), 0 otherwise. inherited is the package_hash() of the name a fork of a
+// secondary zygote starts out with, or 0 for forks of zygote
+static int detect(const struct proc_handle* proc, uint32_t inherited, char* cmdline, uid_t* uid) {
+    struct stat stat;
+    if (proc_fstatat(proc, "task", &stat) != 0) return 0;
+    if (stat.st_uid == 0) return 0;
+    *uid = stat.st_uid;
+
+    int fd = proc_openat(proc, "cmdline", O_RDONLY);
+    if (fd >= 0) {
+        int len = read(fd, cmdline, 128);
+        if ((len > 0) && (len < 128)) {
+            cmdline[len] = '\0';
+            for (int i = 0; i < len; i++) {
+                if ((cmdline[i] == ' ') || (cmdline[i] == ':') || (cmdline[i] == '\0')) {
+                    cmdline[i] = '\0';
+                    break;
+                }
+            }
+        }
+        close(fd);
+
+        // USAP pool processes (Android 10+) are named usap32/usap64 while they wait, and only
+        // get their final name after the uid has already changed on specialization. The same
+        // goes for forks of secondary zygotes, which keep the name of their parent until then.
+        if ((strcmp(cmdline, "zygote") != 0) && (strcmp(cmdline, "zygote64") != 0) && (strncmp(cmdline, "<", 1) != 0) &&
+            (strcmp(cmdline, "usap32") != 0) && (strcmp(cmdline, "usap64") != 0) &&
+            ((inherited == 0) || (package_hash(cmdline) != inherited))) {
+            // Name has been prettified at this point, (see com_android_internal_os_Zygote.cpp::setThreadName() or
+            // ZygoteConnection.java::handleChildProc()).
+            // The process's mount namespace should already be private (see com_android_internal_os_Zygote.cpp::MountEmulatedStorage()).
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// detect() and record its outcome, see record.h
+int detect_package(const struct proc_handle* proc, uint32_t inherited, char* cmdline, uid_t* uid) {
+    int detected = detect(proc, inherited, cmdline, uid);
+    record_package(proc->pid, detected, detected ? *uid : 0, cmdline);
+    return detected;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _PACKAGE_H
+#define _PACKAGE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "prochandle.h"
+
+uint32_t package_hash(const char* name);
+int detect_package(const struct proc_handle* proc, uint32_t inherited, char* cmdline, uid_t* uid);
+
+#endif
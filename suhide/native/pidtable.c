@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Sparse table of tracee state keyed by pid, using open addressing with linear probing. Memory
+ * use is proportional to the number of live tracees rather than to pid_max, so it works the
+ * same on kernels with a pid_max of 32768 or 4194304.
+ *
+ * Entries returned by pidtable_get() and pidtable_add() are only valid until the next
+ * pidtable_add(), which may grow the table and move them.
+ *
+ * The entries of a thread group are chained from the leader by pid, so removing a group
+ * only visits its own entries.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ndklog.h"
+#include "pidtable.h"
+
+#define PIDTABLE_MIN 256
+
+#define SLOT_EMPTY 0
+#define SLOT_REMOVED -1
+
+static struct tracee* slots = NULL;
+static unsigned int capacity = 0; // always a power of 2
+static unsigned int used = 0; // live entries
+static unsigned int removed = 0; // tombstones
+static unsigned int next_generation = 1;
+
+// multiplicative hash, pids are sequential so spread them out
+static inline unsigned int slot_for(pid_t pid) {
+    return ((unsigned int)pid * 2654435761u) & (capacity - 1);
+}
+
+// find the slot holding pid, returns NULL if not present
+static struct tracee* find(pid_t pid) {
+    if (capacity == 0) return NULL;
+    for (unsigned int i = slot_for(pid); ; i = (i + 1) & (capacity - 1)) {
+        if (slots[i].pid == pid) return &slots[i];
+        if (slots[i].pid == SLOT_EMPTY) return NULL;
+    }
+}
+
+// (re)allocate the table at new_capacity, dropping tombstones, returns 0 on success
+static int resize(unsigned int new_capacity) {
+    struct tracee* old = slots;
+    unsigned int old_capacity = capacity;
+
+    struct tracee* new_slots = (struct tracee*)calloc(new_capacity, sizeof(struct tracee));
+    if (new_slots == NULL) return 1;
+    slots = new_slots;
+    capacity = new_capacity;
+    removed = 0;
+
+    for (unsigned int i = 0; i < old_capacity; i++) {
+        if (old[i].pid > 0) {
+            unsigned int j = slot_for(old[i].pid);
+            while (slots[j].pid != SLOT_EMPTY) j = (j + 1) & (capacity - 1);
+            slots[j] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+// take tracee out of its group's chain. If it leads a group, the remaining entries are let go
+// of as well; their leader_generation no longer matches, so pidtable_leader() gives 0 for them
+static void unlink_group(struct tracee* tracee) {
+    if (tracee->leader == tracee->pid) {
+        pid_t next = tracee->next_thread;
+        while (next != 0) {
+            struct tracee* thread = find(next);
+            next = thread->next_thread;
+            thread->prev_thread = 0;
+            thread->next_thread = 0;
+        }
+    } else if (tracee->prev_thread != 0) {
+        find(tracee->prev_thread)->next_thread = tracee->next_thread;
+        if (tracee->next_thread != 0) find(tracee->next_thread)->prev_thread = tracee->prev_thread;
+    }
+    tracee->prev_thread = 0;
+    tracee->next_thread = 0;
+}
+
+// get state for pid, returns NULL if pid is not in the table
+struct tracee* pidtable_get(pid_t pid) {
+    if (pid <= 0) return NULL;
+    return find(pid);
+}
+
+// add pid to the table, or reset its state if already present (recycled pid). The returned entry
+// has a fresh generation and all other state cleared. Returns NULL on allocation failure.
+struct tracee* pidtable_add(pid_t pid) {
+    if (pid <= 0) return NULL;
+
+    struct tracee* tracee = find(pid);
+    if (tracee == NULL) {
+        // keep load (including tombstones) under 3/4
+        if ((used + removed + 1) * 4 > capacity * 3) {
+            unsigned int new_capacity = capacity < PIDTABLE_MIN ? PIDTABLE_MIN : capacity;
+            while ((used + 1) * 2 > new_capacity) new_capacity *= 2;
+            if (resize(new_capacity) != 0) {
+                LOGD("[%d] pidtable: out of memory", pid);
+                return NULL;
+            }
+        }
+
+        unsigned int i = slot_for(pid);
+        while (slots[i].pid > 0) i = (i + 1) & (capacity - 1);
+        if (slots[i].pid == SLOT_REMOVED) removed--;
+        tracee = &slots[i];
+        used++;
+    } else {
+        unlink_group(tracee);
+        proc_handle_close(&tracee->proc);
+    }
+
+    memset(tracee, 0, sizeof(*tracee));
+    tracee->pid = pid;
+    proc_handle_init(&tracee->proc, pid);
+    tracee->generation = next_generation++;
+    if (next_generation == 0) next_generation = 1;
+    return tracee;
+}
+
+// remove pid from the table
+void pidtable_remove(pid_t pid) {
+    struct tracee* tracee = pidtable_get(pid);
+    if (tracee == NULL) return;
+    unlink_group(tracee);
+    proc_handle_close(&tracee->proc);
+    memset(tracee, 0, sizeof(*tracee));
+    tracee->pid = SLOT_REMOVED;
+    used--;
+    removed++;
+}
+
+// remove leader and all entries that have it as their thread group leader
+void pidtable_remove_group(pid_t leader) {
+    struct tracee* tracee = pidtable_get(leader);
+    if (tracee == NULL) return;
+
+    pid_t next = tracee->next_thread;
+    while (next != 0) {
+        struct tracee* thread = find(next);
+        next = thread->next_thread;
+        pidtable_remove(thread->pid);
+    }
+    pidtable_remove(leader);
+}
+
+// make tracee an entry of leader's thread group, and chain it from leader. Does nothing if
+// leader is not in the table
+void pidtable_join(struct tracee* tracee, pid_t leader) {
+    struct tracee* head = pidtable_get(leader);
+    if ((head == NULL) || (head == tracee)) return;
+    unlink_group(tracee);
+    tracee->leader = leader;
+    tracee->leader_generation = head->generation;
+    tracee->prev_thread = leader;
+    tracee->next_thread = head->next_thread;
+    if (head->next_thread != 0) find(head->next_thread)->prev_thread = tracee->pid;
+    head->next_thread = tracee->pid;
+}
+
+// get the thread group leader for tracee, returns 0 if it has none or the leader's pid has
+// since been recycled
+pid_t pidtable_leader(struct tracee* tracee) {
+    if ((tracee == NULL) || (tracee->leader == 0)) return 0;
+    struct tracee* leader = pidtable_get(tracee->leader);
+    if ((leader == NULL) || (leader->generation != tracee->leader_generation)) return 0;
+    return tracee->leader;
+}
+
+// iterate over live entries, iter must start at 0. Returns NULL when done. Entries may be
+// removed during iteration, but not added
+struct tracee* pidtable_next(int* iter) {
+    while ((unsigned int)*iter < capacity) {
+        struct tracee* tracee = &slots[(*iter)++];
+        if (tracee->pid > 0) return tracee;
+    }
+    return NULL;
+}
+
+// number of live entries
+int pidtable_count() {
+    return (int)used;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _PIDTABLE_H
+#define _PIDTABLE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "prochandle.h"
+
+// state kept per traced pid (or tid)
+struct tracee {
+    pid_t pid;                      // 0 if slot is empty, -1 if slot was removed
+    pid_t leader;                   // thread group leader for zygote forks and their clones, 0 otherwise
+    unsigned int generation;        // unique per pidtable_add(), so recycled pids can be told apart
+    unsigned int leader_generation; // generation of leader at the time this entry was added
+    pid_t prev_thread;              // previous entry in leader's group, the leader for the first one
+    pid_t next_thread;              // next entry in leader's group, 0 for the last one
+    unsigned char first_stop;       // next stop is the initial stop of a new fork or clone
+    unsigned char forked;           // forked from zygote, or clone of such a fork
+    unsigned char unmounting;       // leader only: unmount of this app is in progress
+    unsigned char helper;           // unmount helper process, not traced
+    unsigned char zygote;           // leader only: index of the zygote it was forked from
+    unsigned char secondary;        // leader only: secondary zygote (app_zygote, webview_zygote), kept traced
+    unsigned char fork_traced;      // thread of a secondary zygote with PTRACE_O_TRACEFORK set
+    unsigned char held;             // new thread kept stopped until the unmount of its leader is done
+    unsigned char early;            // initial stop seen before the fork or clone event, kept stopped
+    pid_t server;                   // leader only: secondary zygote it was forked from, 0 if from zygote
+    uint32_t inherited;             // leader only: package_hash() of the name it was forked with, 0 if from
+                                    // zygote; for a secondary zygote, that of its own name
+    pid_t resume;                   // leader only: stopped thread to continue once the unmount is done
+    uint64_t forked_at;             // leader only: monotonic_ns() at fork; if early, at the stop
+    uint64_t detected_at;           // leader only: monotonic_ns() at package detection
+    struct proc_handle proc;        // leader only: handle opened at fork, closed on removal
+};
+
+struct tracee* pidtable_get(pid_t pid);
+struct tracee* pidtable_add(pid_t pid);
+void pidtable_remove(pid_t pid);
+void pidtable_remove_group(pid_t leader);
+void pidtable_join(struct tracee* tracee, pid_t leader);
+pid_t pidtable_leader(struct tracee* tracee);
+struct tracee* pidtable_next(int* iter);
+int pidtable_count();
+
+#endif
@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Precomputed unmount plan. App namespaces are copies of zygote's namespace, so the
+ * root-related mounts are the same for every app. They are determined once from zygote's
+ * mountinfo and reused for every launch, until zygote's mount table changes (signalled by
+ * POLLPRI on its mountinfo fd) or the rules are reloaded. A plan is cached per zygote.
+ *
+ * Plans are built from the mount tree (mount id and parent id) rather than mountinfo order,
+ * and only contain the topmost matching mounts, as detaching those removes their children too.
+ * Mounts stacked on the same mount point are the exception: unmounting by path only detaches
+ * the topmost of them, so a stack needs one unmount per mount down to the lowest match.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "ndklog.h"
+#include "mountinfo.h"
+#include "plan.h"
+
+#define CACHE_SIZE 4 // zygotes
+
+// cached plan and what it was built from; rules holds a reference so the pointer cannot be
+// reused by a newer rule set, and zygote is our own handle so a reused pid is not mistaken
+// for it
+struct cache {
+    struct proc_handle zygote; // pid 0 if unused
+    int mountinfo_fd;
+    struct plan* plan;
+    struct rules* rules;
+};
+
+static struct cache caches[CACHE_SIZE];
+
+// take an additional reference to plan
+void plan_acquire(struct plan* plan) {
+    __sync_fetch_and_add(&plan->refs, 1);
+}
+
+// drop a reference to plan, freeing it when it was the last
+void plan_release(struct plan* plan) {
+    if ((plan != NULL) && (__sync_sub_and_fetch(&plan->refs, 1) == 0)) {
+        for (int i = 0; i < plan->count; i++) {
+            free(plan->entries[i].target);
+        }
+        free(plan->entries);
+        free(plan);
+    }
+}
+
+// mount as read from mountinfo, while building a plan
+struct mount {
+    int id;
+    int parent;
+    int match;      // matched by rules
+    int covered;    // has an ancestor at another mount point that is unmounted
+    int stacked;    // mounted on top of its parent, at the same mount point
+    int removed;    // unmounted: covered, matched, or stacked on a removed mount
+    int base;       // index of the lowest removed mount of its stack, if removed
+    int unmounts;   // for a base, removed mounts in its stack including itself
+    int depth;
+    int state;      // 0 unresolved, 1 resolving, 2 resolved
+    char* target;   // as in mountinfo, still encoded
+};
+
+static int compare_id(const void* a, const void* b) {
+    const struct mount* x = (const struct mount*)a;
+    const struct mount* y = (const struct mount*)b;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+// deepest first; entries are disjoint subtrees so any order works, but this keeps it stable
+static int compare_depth(const void* a, const void* b) {
+    const struct plan_entry* x = (const struct plan_entry*)a;
+    const struct plan_entry* y = (const struct plan_entry*)b;
+    if (x->depth != y->depth) return y->depth - x->depth;
+    return x->id - y->id;
+}
+
+// resolve depth, covered and removed for mounts[i], mounts sorted by id
+static void resolve(struct mount* mounts, int count, int i) {
+    struct mount* m = &mounts[i];
+    if (m->state != 0) return;
+    m->state = 1; // guards against parent cycles
+    m->base = i;
+
+    struct mount key;
+    key.id = m->parent;
+    struct mount* parent = (m->parent != m->id) ? (struct mount*)bsearch(&key, mounts, count, sizeof(struct mount), compare_id) : NULL;
+    if (parent != NULL) resolve(mounts, count, parent - mounts);
+    if ((parent != NULL) && (parent->state == 2)) {
+        m->depth = parent->depth + 1;
+        m->stacked = (strcmp(m->target, parent->target) == 0);
+        // a mount on top of its parent is not taken along by unmounting the parent by path,
+        // it is in the way and has to be unmounted first
+        m->covered = parent->covered || (parent->removed && !m->stacked);
+        if (m->stacked && parent->removed && !parent->covered) m->base = parent->base;
+    }
+    m->removed = m->covered || m->match || (m->stacked && (parent != NULL) && parent->removed);
+    m->state = 2;
+}
+
+// build a plan from the mountinfo in fd, returns NULL on failure. The plan holds the minimal
+// set of matching mounts covering all matches: unmounting with MNT_DETACH takes a mount's
+// whole subtree with it, so matches below another match are skipped
+struct plan* plan_build(int fd, const struct rules* rules) {
+    struct mount* mounts = NULL;
+    int count = 0;
+    int capacity = 0;
+    int ok = 1;
+
+    // all mounts are needed to reconstruct the tree, not just matches
+    struct mountinfo_reader reader;
+    struct mountinfo_entry entry;
+    if (mountinfo_open(&reader, fd) != 0) return NULL;
+    int r = 0;
+    while ((r = mountinfo_next(&reader, &entry)) > 0) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            struct mount* grown = (struct mount*)realloc(mounts, sizeof(struct mount) * capacity);
+            if (grown == NULL) {
+                ok = 0;
+                break;
+            }
+            mounts = grown;
+        }
+        struct mount* m = &mounts[count];
+        memset(m, 0, sizeof(*m));
+        m->id = entry.id;
+        m->parent = entry.parent;
+        m->match = rules_match(rules, &entry);
+        count++;
+        // compared encoded to find stacked mounts, only matches are decoded
+        m->target = strdup(entry.target);
+        if (m->target == NULL) {
+            ok = 0;
+            break;
+        }
+    }
+    mountinfo_close(&reader);
+    if (r < 0) ok = 0;
+
+    struct plan* plan = ok ? (struct plan*)calloc(1, sizeof(struct plan)) : NULL;
+    if (plan != NULL) {
+        plan->refs = 1;
+        qsort(mounts, count, sizeof(struct mount), compare_id);
+        for (int i = 0; i < count; i++) {
+            resolve(mounts, count, i);
+        }
+        for (int i = 0; i < count; i++) {
+            if (mounts[i].match && mounts[i].covered) plan->covered++;
+            if (mounts[i].removed && !mounts[i].covered) {
+                if (mounts[i].base == i) plan->count++;
+                mounts[mounts[i].base].unmounts++;
+            }
+        }
+
+        plan->entries = (struct plan_entry*)malloc(sizeof(struct plan_entry) * (plan->count + 1));
+        if (plan->entries != NULL) {
+            int n = 0;
+            for (int i = 0; (i < count) && (n < plan->count); i++) {
+                if (mounts[i].removed && !mounts[i].covered && (mounts[i].base == i)) {
+                    char decoded[PATH_MAX];
+                    plan->entries[n].id = mounts[i].id;
+                    plan->entries[n].parent = mounts[i].parent;
+                    plan->entries[n].depth = mounts[i].depth;
+                    plan->entries[n].unmounts = mounts[i].unmounts;
+                    plan->entries[n].target = strdup(mountinfo_decode(mounts[i].target, decoded, PATH_MAX));
+                    if (plan->entries[n].target == NULL) break;
+                    n++;
+                }
+            }
+            if (n < plan->count) {
+                plan->count = n;
+                plan_release(plan);
+                plan = NULL;
+            } else {
+                qsort(plan->entries, plan->count, sizeof(struct plan_entry), compare_depth);
+            }
+        } else {
+            plan->count = 0;
+            plan_release(plan);
+            plan = NULL;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(mounts[i].target);
+    }
+    free(mounts);
+    return plan;
+}
+
+// free cache's plan and close its fds, making it available for another zygote
+static void drop(struct cache* cache) {
+    LOGD("plan: [%d] dropped", cache->zygote.pid);
+    plan_release(cache->plan);
+    cache->plan = NULL;
+    rules_release(cache->rules);
+    cache->rules = NULL;
+    if (cache->mountinfo_fd >= 0) close(cache->mountinfo_fd);
+    cache->mountinfo_fd = -1;
+    proc_handle_close(&cache->zygote);
+    cache->zygote.pid = 0;
+}
+
+// find zygote's cache, or a free one. A cache with zygote's pid whose process has died is that
+// of an earlier process with the same pid, and is dropped, as are dead ones if all are in use.
+// Returns NULL if there is no room
+static struct cache* find(const struct proc_handle* zygote) {
+    struct cache* unused = NULL;
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        struct cache* cache = &caches[i];
+        if (cache->zygote.pid == zygote->pid) {
+            if (proc_handle_alive(&cache->zygote)) return cache;
+            drop(cache);
+        }
+        if ((cache->zygote.pid == 0) && (unused == NULL)) unused = cache;
+    }
+    for (int i = 0; (i < CACHE_SIZE) && (unused == NULL); i++) {
+        if (!proc_handle_alive(&caches[i].zygote)) {
+            drop(&caches[i]);
+            unused = &caches[i];
+        }
+    }
+    if (unused != NULL) {
+        proc_handle_dup(&unused->zygote, zygote);
+        unused->mountinfo_fd = -1;
+    }
+    return unused;
+}
+
+// drop the cached plan of zygote, which has exited
+void plan_forget(const struct proc_handle* zygote) {
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        if (caches[i].zygote.pid == zygote->pid) drop(&caches[i]);
+    }
+}
+
+// get the plan for zygote's namespace with rules, rebuilding it if zygote's mounts changed or
+// rules differ from last time. The caller holds a reference to the returned plan and must
+// plan_release() it. Returns NULL if no plan could be built
+struct plan* plan_get(const struct proc_handle* zygote, struct rules* rules) {
+    if (rules == NULL) return NULL;
+
+    struct cache* cache = find(zygote);
+    if (cache == NULL) return NULL;
+
+    if (cache->mountinfo_fd < 0) {
+        cache->mountinfo_fd = proc_openat(zygote, "mountinfo", O_RDONLY);
+        if (cache->mountinfo_fd < 0) return NULL;
+    }
+
+    // POLLPRI (and POLLERR) signal that the mount table changed since we last polled
+    struct pollfd pfd;
+    pfd.fd = cache->mountinfo_fd;
+    pfd.events = POLLPRI;
+    pfd.revents = 0;
+    int changed = (poll(&pfd, 1, 0) > 0) && (pfd.revents & (POLLPRI | POLLERR));
+
+    if ((cache->plan != NULL) && (changed || (cache->rules != rules))) {
+        LOGD("plan: [%d] invalidated", cache->zygote.pid);
+        plan_release(cache->plan);
+        cache->plan = NULL;
+        rules_release(cache->rules);
+        cache->rules = NULL;
+    }
+
+    if (cache->plan == NULL) {
+        if (lseek(cache->mountinfo_fd, 0, SEEK_SET) != 0) return NULL;
+        cache->plan = plan_build(cache->mountinfo_fd, rules);
+        if (cache->plan == NULL) return NULL;
+        cache->rules = rules;
+        rules_acquire(cache->rules);
+        LOGD("plan: [%d] %d mounts, %d covered", cache->zygote.pid, cache->plan->count, cache->plan->covered);
+    }
+
+    plan_acquire(cache->plan);
+    return cache->plan;
+}
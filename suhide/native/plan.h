@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _PLAN_H
+#define _PLAN_H
+
+#include "prochandle.h"
+#include "rules.h"
+
+// root-related mount to unmount
+struct plan_entry {
+    int id;
+    int parent;
+    int depth;      // distance from the namespace's root mount
+    int unmounts;   // mounts stacked at target from this one up, each needs its own unmount
+    char* target;   // decoded mount point
+};
+
+// root-related mounts of a namespace in the order they should be unmounted
+struct plan {
+    int refs;
+    int count;
+    int covered;    // matching mounts skipped because an ancestor is unmounted
+    struct plan_entry* entries;
+};
+
+struct plan* plan_build(int fd, const struct rules* rules);
+struct plan* plan_get(const struct proc_handle* zygote, struct rules* rules);
+void plan_forget(const struct proc_handle* zygote);
+void plan_acquire(struct plan* plan);
+void plan_release(struct plan* plan);
+
+#endif
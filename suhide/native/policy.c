@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Compiler and lookups for the binary policy format. This file does not depend on Android
+ * headers, so suhide_compile can be built and run on a regular Linux host as well.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "policy.h"
+
+#ifndef AID_USER
+#define AID_USER 100000
+#endif
+#ifndef AID_APP
+#define AID_APP 10000
+#endif
+
+#define BITMAP_SIZE (((AID_USER - AID_APP) + 31) / 32 * 4)
+#define AT(policy, offset, type) ((type)((char*)(policy) + (offset)))
+
+// FNV-1a
+static uint32_t hash_name(const char* name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t hash_uid(uint32_t uid) {
+    uint32_t hash = uid * 2654435761u;
+    return hash ^ (hash >> 16);
+}
+
+// smallest power of two holding count entries at no more than half load
+static uint32_t slot_count(int count) {
+    uint32_t slots = 8;
+    while (slots < (uint32_t)count * 2) slots <<= 1;
+    return slots;
+}
+
+// add a hidden uid, app ids below AID_APP are never hidden so are not stored
+static void add_uid(struct policy* policy, uid_t uid) {
+    uint32_t app_id = uid % AID_USER;
+    if (app_id < AID_APP) return;
+    if (uid < AID_USER) {
+        uint32_t* bitmap = AT(policy, policy->bitmap, uint32_t*);
+        bitmap[(app_id - AID_APP) >> 5] |= 1u << ((app_id - AID_APP) & 31);
+        return;
+    }
+    uint32_t* slots = AT(policy, policy->uid_slots, uint32_t*);
+    for (uint32_t i = hash_uid(uid) & policy->uid_mask; ; i = (i + 1) & policy->uid_mask) {
+        if (slots[i] == uid) return;
+        if (slots[i] == 0) {
+            slots[i] = uid;
+            return;
+        }
+    }
+}
+
+// add a hidden process name, which must already be in the policy
+static void add_name(struct policy* policy, uint32_t offset) {
+    const char* name = AT(policy, offset, const char*);
+    uint32_t hash = hash_name(name);
+    struct policy_name* slots = AT(policy, policy->name_slots, struct policy_name*);
+    for (uint32_t i = hash & policy->name_mask; ; i = (i + 1) & policy->name_mask) {
+        if (slots[i].name == 0) {
+            slots[i].hash = hash;
+            slots[i].name = offset;
+            return;
+        }
+        if ((slots[i].hash == hash) && (strcmp(AT(policy, slots[i].name, const char*), name) == 0)) return;
+    }
+}
+
+// compile the uids and process names root should be hidden from, text is tokenized in place
+// and must have room for a terminating NUL at text[len]. Returns NULL on failure, the caller
+// must free() the result
+struct policy* policy_compile(char* text, size_t len, uint32_t generation) {
+    text[len] = '\0';
+    len++;
+
+    // first loop sizes the policy, second loop fills it
+    struct policy* policy = NULL;
+    uint32_t strings = 0;
+    int count_uid = 0;
+    int count_process = 0;
+    int size_process = 0;
+    for (int loop = 0; loop < 2; loop++) {
+        if (loop == 1) {
+            uint32_t uid_slots = slot_count(count_uid);
+            uint32_t name_slots = slot_count(count_process);
+            uint32_t size = sizeof(struct policy);
+            uint32_t bitmap = size;
+            size += BITMAP_SIZE;
+            uint32_t uids = size;
+            size += uid_slots * sizeof(uint32_t);
+            uint32_t names = size;
+            size += name_slots * sizeof(struct policy_name);
+            strings = size;
+            size += size_process;
+
+            policy = (struct policy*)calloc(1, size);
+            if (policy == NULL) return NULL;
+            policy->magic = POLICY_MAGIC;
+            policy->version = POLICY_VERSION;
+            policy->generation = generation;
+            policy->size = size;
+            policy->bitmap = bitmap;
+            policy->uid_slots = uids;
+            policy->uid_mask = uid_slots - 1;
+            policy->uid_count = count_uid;
+            policy->name_slots = names;
+            policy->name_mask = name_slots - 1;
+            policy->name_count = count_process;
+            policy->strings = strings;
+            count_uid = 0;
+            count_process = 0;
+        }
+
+        int start = 0;
+        for (int i = 0; i < (int)len; i++) {
+            if ((text[i] == '\r') || (text[i] == '\n') || (text[i] == ' ')) text[i] = '\0';
+            if (text[i] == '\0') {
+                if ((start > -1) && (start < i - 1)) {
+                    uid_t uid = atoi(&text[start]);
+                    if (uid > 0) {
+                        if (loop == 1) add_uid(policy, uid);
+                        count_uid++;
+                    } else {
+                        int size = i - start + 1;
+                        if (loop == 1) {
+                            memcpy(AT(policy, strings, char*), &text[start], size);
+                            add_name(policy, strings);
+                            strings += size;
+                        } else {
+                            size_process += size;
+                        }
+                        count_process++;
+                    }
+                }
+                start = i + 1;
+            }
+        }
+    }
+
+    policy->checksum = policy_checksum(policy);
+    return policy;
+}
+
+// FNV-1a of everything after the header
+uint32_t policy_checksum(const struct policy* policy) {
+    uint32_t hash = 2166136261u;
+    const unsigned char* data = (const unsigned char*)policy;
+    for (uint32_t i = sizeof(struct policy); i < policy->size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// check the header's tables lie within size bytes, without looking at their contents,
+// returns 0 if so
+static int bounded(const struct policy* header, size_t size) {
+    if ((header->magic != POLICY_MAGIC) || (header->version != POLICY_VERSION)) return 1;
+    if ((header->size < sizeof(struct policy)) || (header->size > size)) return 1;
+    size = header->size;
+
+    uint64_t uid_end = (uint64_t)header->uid_slots + ((uint64_t)header->uid_mask + 1) * sizeof(uint32_t);
+    uint64_t name_end = (uint64_t)header->name_slots + ((uint64_t)header->name_mask + 1) * sizeof(struct policy_name);
+    if ((header->bitmap < sizeof(struct policy)) || ((uint64_t)header->bitmap + BITMAP_SIZE > size)) return 1;
+    if ((header->uid_slots < sizeof(struct policy)) || (uid_end > size)) return 1;
+    if ((header->name_slots < sizeof(struct policy)) || (name_end > size)) return 1;
+    if ((header->uid_mask & (header->uid_mask + 1)) || (header->name_mask & (header->name_mask + 1))) return 1;
+    if ((header->uid_slots & 3) || (header->name_slots & 3) || (header->bitmap & 3)) return 1;
+    if ((header->strings < sizeof(struct policy)) || (header->strings > size)) return 1;
+    return 0;
+}
+
+// check a policy of size bytes (as read from a file) can be used safely, returns 0 if so
+int policy_verify(const struct policy* policy, size_t size) {
+    if (size < sizeof(struct policy)) return 1;
+    if ((policy->size != size) || (bounded(policy, size) != 0)) return 1;
+
+    // names must be terminated
+    if ((size > policy->strings) && (((const char*)policy)[size - 1] != '\0')) return 1;
+
+    // lookups stop at the first empty slot, so there must be one
+    int empty = 0;
+    const struct policy_name* slots = AT(policy, policy->name_slots, const struct policy_name*);
+    for (uint32_t i = 0; i <= policy->name_mask; i++) {
+        if (slots[i].name == 0) {
+            empty = 1;
+        } else if ((slots[i].name < policy->strings) || (slots[i].name >= size)) {
+            return 1;
+        }
+    }
+    if (!empty) return 1;
+    empty = 0;
+    const uint32_t* uids = AT(policy, policy->uid_slots, const uint32_t*);
+    for (uint32_t i = 0; i <= policy->uid_mask; i++) {
+        if (uids[i] == 0) empty = 1;
+    }
+    if (!empty) return 1;
+
+    return policy_checksum(policy) == policy->checksum ? 0 : 1;
+}
+
+// The lookups below read the header once and never leave the first size bytes, so they
+// are safe on a policy that is being overwritten (see sharedpolicy.c), provided a NUL
+// follows within size. The answer is meaningless in that case, and must be discarded.
+
+// is root access allowed for uid ?
+int policy_allow_uid(const struct policy* policy, size_t size, uid_t uid) {
+    uint32_t app_id = uid % AID_USER;
+    if (app_id < AID_APP) return 1;
+
+    if (policy == NULL) return 1;
+    struct policy header;
+    memcpy(&header, policy, sizeof(header));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if ((header.uid_count == 0) || (bounded(&header, size) != 0)) return 1;
+
+    if (uid < AID_USER) {
+        const uint32_t* bitmap = AT(policy, header.bitmap, const uint32_t*);
+        return (bitmap[(app_id - AID_APP) >> 5] & (1u << ((app_id - AID_APP) & 31))) == 0;
+    }
+
+    const uint32_t* slots = AT(policy, header.uid_slots, const uint32_t*);
+    uint32_t i = hash_uid(uid) & header.uid_mask;
+    for (uint32_t probe = 0; probe <= header.uid_mask; probe++, i = (i + 1) & header.uid_mask) {
+        uint32_t slot = slots[i];
+        if (slot == 0) break;
+        if (slot == uid) return 0;
+    }
+
+    return 1;
+}
+
+// is root access allowed for process name ?
+int policy_allow_name(const struct policy* policy, size_t size, const char* name) {
+    if (policy == NULL) return 1;
+    struct policy header;
+    memcpy(&header, policy, sizeof(header));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if ((header.name_count == 0) || (bounded(&header, size) != 0)) return 1;
+
+    uint32_t hash = hash_name(name);
+    const struct policy_name* slots = AT(policy, header.name_slots, const struct policy_name*);
+    uint32_t i = hash & header.name_mask;
+    for (uint32_t probe = 0; probe <= header.name_mask; probe++, i = (i + 1) & header.name_mask) {
+        struct policy_name slot = slots[i];
+        if (slot.name == 0) break;
+        if ((slot.hash == hash) && (slot.name >= header.strings) && (slot.name < header.size) &&
+                (strcmp(AT(policy, slot.name, const char*), name) == 0)) return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _POLICY_H
+#define _POLICY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define POLICY_MAGIC 0x50524853 // "SHRP"
+#define POLICY_VERSION 1
+
+/* Compiled form of suhide.uid, a single position-independent block that is either built in
+ * memory or mapped from a file written by suhide_compile. Hidden uids of user 0 are kept in
+ * a bitmap over the app id range, those of other users in a hash set; process names in a
+ * hash set. All references within are offsets from the start of the header.
+ */
+struct policy {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t generation;    // bumped by suhide_compile every time it writes the file
+    uint32_t checksum;      // FNV-1a of everything after the header
+    uint32_t size;          // of the whole block, including the header
+    uint32_t reserved;
+    uint64_t source_size;   // size and mtime (ns) of the text file this was compiled from
+    uint64_t source_mtime;
+    uint32_t uid_count;
+    uint32_t bitmap;        // bits for app ids AID_APP to AID_USER - 1 of user 0
+    uint32_t uid_slots;     // uint32_t[uid_mask + 1], 0 is empty
+    uint32_t uid_mask;
+    uint32_t name_count;
+    uint32_t name_slots;    // struct policy_name[name_mask + 1]
+    uint32_t name_mask;
+    uint32_t strings;       // NUL-terminated names
+};
+
+struct policy_name {
+    uint32_t hash;
+    uint32_t name;          // offset of the name, 0 is empty
+};
+
+struct policy* policy_compile(char* text, size_t len, uint32_t generation);
+uint32_t policy_checksum(const struct policy* policy);
+int policy_verify(const struct policy* policy, size_t size);
+int policy_allow_uid(const struct policy* policy, size_t size, uid_t uid);
+int policy_allow_name(const struct policy* policy, size_t size, const char* name);
+
+#endif
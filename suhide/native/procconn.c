@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Kernel proc connector (netlink) helpers. The proc connector broadcasts fork, exec, id
+ * change, comm change and exit events for every process on the system, which allows us to
+ * follow zygote's children without being their tracer. Requires CAP_NET_ADMIN.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#include "ndklog.h"
+#include "procconn.h"
+
+// open a netlink socket subscribed to proc connector events, returns fd or -1 on error
+int procconn_open() {
+    int fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (fd < 0) {
+        LOGD("procconn: socket failed [%d]", errno);
+        return -1;
+    }
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    addr.nl_pid = getpid();
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        LOGD("procconn: bind failed [%d]", errno);
+        close(fd);
+        return -1;
+    }
+
+    // header, connector message and listen op need to be contiguous
+    struct __attribute__((aligned(NLMSG_ALIGNTO))) {
+        struct nlmsghdr nl;
+        struct __attribute__((packed)) {
+            struct cn_msg cn;
+            enum proc_cn_mcast_op op;
+        } msg;
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.nl.nlmsg_len = sizeof(req);
+    req.nl.nlmsg_type = NLMSG_DONE;
+    req.nl.nlmsg_pid = getpid();
+    req.msg.cn.id.idx = CN_IDX_PROC;
+    req.msg.cn.id.val = CN_VAL_PROC;
+    req.msg.cn.len = sizeof(enum proc_cn_mcast_op);
+    req.msg.op = PROC_CN_MCAST_LISTEN;
+    if (send(fd, &req, sizeof(req), 0) != sizeof(req)) {
+        LOGD("procconn: listen failed [%d]", errno);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// only let events of the given PROC_EVENT_* types through, so the kernel drops all others
+// before they are queued to us (and wake us up), returns 0 on success
+int procconn_filter(int fd, const unsigned int* whats, int count) {
+    struct sock_filter code[16];
+    if ((count <= 0) || (count > 13)) return 1;
+
+    // load the event type, which BPF reads in network byte order
+    code[0] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+        NLMSG_LENGTH(0) + offsetof(struct cn_msg, data) + offsetof(struct proc_event, what));
+    for (int i = 0; i < count; i++) {
+        code[1 + i] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htonl(whats[i]), count - i, 0);
+    }
+    code[1 + count] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+    code[2 + count] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+
+    struct sock_fprog prog = { (unsigned short)(count + 3), code };
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) != 0) {
+        LOGD("procconn: filter failed [%d]", errno);
+        return 1;
+    }
+    return 0;
+}
+
+// read the next proc connector event, blocks. returns 1 if event was filled, 0 if the
+// message was not an event we handle, 2 if the kernel dropped events because we fell behind,
+// -1 on error
+int procconn_read(int fd, struct procconn_event* event) {
+    char buf[1024] __attribute__((aligned(NLMSG_ALIGNTO)));
+    ssize_t len = recv(fd, buf, sizeof(buf), 0);
+    if (len <= 0) {
+        return ((len < 0) && (errno == ENOBUFS)) ? 2 : -1;
+    }
+
+    struct nlmsghdr* nl = (struct nlmsghdr*)buf;
+    if (!NLMSG_OK(nl, (size_t)len) || (nl->nlmsg_type != NLMSG_DONE)) return 0;
+
+    struct cn_msg* cn = (struct cn_msg*)NLMSG_DATA(nl);
+    if ((cn->id.idx != CN_IDX_PROC) || (cn->id.val != CN_VAL_PROC)) return 0;
+    struct proc_event* ev = (struct proc_event*)cn->data;
+
+    memset(event, 0, sizeof(*event));
+    event->what = ev->what;
+    switch ((unsigned int)ev->what) {
+        case PROC_EVENT_FORK:
+            event->pid = ev->event_data.fork.child_pid;
+            event->tgid = ev->event_data.fork.child_tgid;
+            event->parent_pid = ev->event_data.fork.parent_pid;
+            event->parent_tgid = ev->event_data.fork.parent_tgid;
+            return 1;
+        case PROC_EVENT_UID:
+            event->pid = ev->event_data.id.process_pid;
+            event->tgid = ev->event_data.id.process_tgid;
+            event->uid = ev->event_data.id.e.euid;
+            return 1;
+        case PROC_EVENT_COMM:
+            event->pid = ev->event_data.comm.process_pid;
+            event->tgid = ev->event_data.comm.process_tgid;
+            memcpy(event->comm, ev->event_data.comm.comm, sizeof(event->comm));
+            event->comm[sizeof(event->comm) - 1] = '\0';
+            return 1;
+        case PROC_EVENT_EXIT:
+            event->pid = ev->event_data.exit.process_pid;
+            event->tgid = ev->event_data.exit.process_tgid;
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _PROCCONN_H
+#define _PROCCONN_H
+
+#include <sys/types.h>
+#include <linux/cn_proc.h>
+
+// a single decoded proc connector event, fields not relevant to what are zero
+struct procconn_event {
+    unsigned int what; // PROC_EVENT_*, PROC_EVENT_EXIT does not fit an int
+    pid_t pid;
+    pid_t tgid;
+    pid_t parent_pid;
+    pid_t parent_tgid;
+    uid_t uid;
+    char comm[16];
+};
+
+int procconn_open();
+int procconn_filter(int fd, const unsigned int* whats, int count);
+int procconn_read(int fd, struct procconn_event* event);
+
+#endif
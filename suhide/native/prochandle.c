@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Process handles based on pidfds. A pidfd is taken as soon as we learn of a process, and the
+ * process's /proc directory is opened and verified against it, so later lookups use openat()
+ * relative to that directory rather than rebuilding /proc/<pid>/... paths, and cannot end up
+ * at a different process if the pid has been recycled. On kernels without pidfd support
+ * everything falls back to plain /proc/<pid> paths.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/syscall.h>
+
+#include "ndklog.h"
+#include "prochandle.h"
+
+// not in older headers; new syscalls share numbers across architectures, except for mips offsets
+#ifndef __NR_pidfd_open
+#if defined(__mips__) && (_MIPS_SIM == _MIPS_SIM_ABI32)
+#define __NR_pidfd_send_signal 4424
+#define __NR_pidfd_open 4434
+#elif defined(__mips__) && (_MIPS_SIM == _MIPS_SIM_ABI64)
+#define __NR_pidfd_send_signal 5424
+#define __NR_pidfd_open 5434
+#elif defined(__mips__)
+#define __NR_pidfd_send_signal 6424
+#define __NR_pidfd_open 6434
+#else
+#define __NR_pidfd_send_signal 424
+#define __NR_pidfd_open 434
+#endif
+#endif
+
+// kernel support, cleared at first failure so we don't keep trying
+static int have_pidfd = 1;
+static int have_setns_pidfd = 1;
+
+// initialize handle for pid without opening anything
+void proc_handle_init(struct proc_handle* handle, pid_t pid) {
+    handle->pid = pid;
+    handle->pidfd = -1;
+    handle->procfd = -1;
+}
+
+// open handle for pid, falls back to path-based access for anything that cannot be opened
+void proc_handle_open(struct proc_handle* handle, pid_t pid) {
+    proc_handle_init(handle, pid);
+    if (!have_pidfd) return;
+
+    handle->pidfd = syscall(__NR_pidfd_open, pid, 0);
+    if (handle->pidfd < 0) {
+        if (errno == ENOSYS) have_pidfd = 0;
+        handle->pidfd = -1;
+        return;
+    }
+    fcntl(handle->pidfd, F_SETFD, FD_CLOEXEC);
+
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "/proc/%d", pid);
+    handle->procfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    // if the process is still alive after opening its /proc directory, that directory is its
+    if ((handle->procfd >= 0) && !proc_handle_alive(handle)) {
+        close(handle->procfd);
+        handle->procfd = -1;
+    }
+}
+
+// duplicate src into dst, so dst may outlive src
+void proc_handle_dup(struct proc_handle* dst, const struct proc_handle* src) {
+    dst->pid = src->pid;
+    dst->pidfd = (src->pidfd >= 0) ? fcntl(src->pidfd, F_DUPFD_CLOEXEC, 0) : -1;
+    dst->procfd = (src->procfd >= 0) ? fcntl(src->procfd, F_DUPFD_CLOEXEC, 0) : -1;
+}
+
+// close handle's fds
+void proc_handle_close(struct proc_handle* handle) {
+    if (handle->pidfd >= 0) close(handle->pidfd);
+    if (handle->procfd >= 0) close(handle->procfd);
+    handle->pidfd = -1;
+    handle->procfd = -1;
+}
+
+// is the process still alive (or a zombie) ?
+int proc_handle_alive(const struct proc_handle* handle) {
+    return proc_handle_kill(handle, 0) == 0;
+}
+
+// check up to PROC_HANDLE_BATCH processes for having exited, setting exited[i] for each that
+// has, zombies included. A pidfd becomes readable when its process exits, so one poll() covers
+// all handles that have one; the others are probed with a signal, and a zombie passes that
+void proc_handle_exited(const struct proc_handle* const* handles, int count, unsigned char* exited) {
+    struct pollfd fds[PROC_HANDLE_BATCH];
+    int polled = 0;
+    for (int i = 0; i < count; i++) {
+        if (handles[i]->pidfd >= 0) {
+            fds[polled].fd = handles[i]->pidfd;
+            fds[polled].events = POLLIN;
+            fds[polled].revents = 0;
+            polled++;
+        } else {
+            exited[i] = !proc_handle_alive(handles[i]);
+        }
+    }
+    if ((polled > 0) && (poll(fds, polled, 0) < 0)) {
+        for (int i = 0; i < polled; i++) fds[i].revents = 0;
+    }
+    polled = 0;
+    for (int i = 0; i < count; i++) {
+        if (handles[i]->pidfd >= 0) exited[i] = fds[polled++].revents != 0;
+    }
+}
+
+// send signal to the process, returns 0 on success
+int proc_handle_kill(const struct proc_handle* handle, int signal) {
+    if (handle->pidfd >= 0) {
+        return syscall(__NR_pidfd_send_signal, handle->pidfd, signal, NULL, 0) == 0 ? 0 : -1;
+    }
+    return kill(handle->pid, signal);
+}
+
+// open a file in the process's /proc directory
+int proc_openat(const struct proc_handle* handle, const char* name, int flags) {
+    if (handle->procfd >= 0) {
+        return openat(handle->procfd, name, flags | O_CLOEXEC);
+    }
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "/proc/%d/%s", handle->pid, name);
+    return open(path, flags | O_CLOEXEC);
+}
+
+// lstat a file in the process's /proc directory
+int proc_fstatat(const struct proc_handle* handle, const char* name, struct stat* st) {
+    if (handle->procfd >= 0) {
+        return fstatat(handle->procfd, name, st, AT_SYMLINK_NOFOLLOW);
+    }
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "/proc/%d/%s", handle->pid, name);
+    return lstat(path, st);
+}
+
+// readlink a file in the process's /proc directory
+ssize_t proc_readlinkat(const struct proc_handle* handle, const char* name, char* buf, size_t size) {
+    if (handle->procfd >= 0) {
+        return readlinkat(handle->procfd, name, buf, size);
+    }
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "/proc/%d/%s", handle->pid, name);
+    return readlink(path, buf, size);
+}
+
+// join the process's mount namespace, using the pidfd directly on Linux 5.8+. Returns 0 on success
+int proc_setns_mnt(const struct proc_handle* handle) {
+    int fallback = 0;
+    if (have_setns_pidfd && (handle->pidfd >= 0)) {
+        if (syscall(__NR_setns, handle->pidfd, CLONE_NEWNS) == 0) return 0;
+        if (errno != EINVAL) return -1;
+        fallback = 1;
+    }
+
+    int nsfd = proc_openat(handle, "ns/mnt", O_RDONLY);
+    if (nsfd < 0) return -1;
+    int ret = syscall(__NR_setns, nsfd, CLONE_NEWNS) == 0 ? 0 : -1;
+    close(nsfd);
+    // EINVAL is also what a shared filesystem context gets, only blame the pidfd if the
+    // namespace file worked where it did not
+    if ((ret == 0) && fallback) have_setns_pidfd = 0;
+    return ret;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _PROCHANDLE_H
+#define _PROCHANDLE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// handles proc_handle_exited() checks at once
+#define PROC_HANDLE_BATCH 64
+
+// reference to a process that cannot be confused with a later process reusing its pid, where
+// the kernel supports it. Either fd may be -1, in which case /proc/<pid> paths are used.
+struct proc_handle {
+    pid_t pid;
+    int pidfd;  // pidfd_open(), requires Linux 5.3
+    int procfd; // /proc/<pid> directory, verified against pidfd
+};
+
+void proc_handle_init(struct proc_handle* handle, pid_t pid);
+void proc_handle_open(struct proc_handle* handle, pid_t pid);
+void proc_handle_dup(struct proc_handle* dst, const struct proc_handle* src);
+void proc_handle_close(struct proc_handle* handle);
+int proc_handle_alive(const struct proc_handle* handle);
+void proc_handle_exited(const struct proc_handle* const* handles, int count, unsigned char* exited);
+int proc_handle_kill(const struct proc_handle* handle, int signal);
+int proc_openat(const struct proc_handle* handle, const char* name, int flags);
+int proc_fstatat(const struct proc_handle* handle, const char* name, struct stat* st);
+ssize_t proc_readlinkat(const struct proc_handle* handle, const char* name, char* buf, size_t size);
+int proc_setns_mnt(const struct proc_handle* handle);
+
+#endif
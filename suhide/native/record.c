@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Recording of the ptrace backend's inputs, so a session on a device can be replayed through
+ * the same state machine on a workstation (see host/replay.c). Recording is off unless the
+ * recording file exists when the tracer starts; it is written with a plain write() per
+ * record rather than buffered, so nothing is lost if the tracer is killed.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "ndklog.h"
+#include "util.h"
+#include "record.h"
+
+static int fd = -1;
+static uint64_t started = 0;
+
+// start recording to path if it exists, returns 0 if recording
+int record_open(const char* path, const pid_t* targets, int count, int flags) {
+    fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+    if (fd < 0) return 1;
+
+    struct record_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = RECORD_MAGIC;
+    header.version = RECORD_VERSION;
+    header.flags = flags;
+    for (int i = 0; (i < count) && (i < RECORD_TARGETS); i++) {
+        header.targets[header.count++] = targets[i];
+    }
+    header.started = started = monotonic_ns();
+    if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+        close(fd);
+        fd = -1;
+        return 1;
+    }
+    LOGD("record: [%s]", path);
+    return 0;
+}
+
+static void append(int type, pid_t pid, int64_t value, const void* payload, size_t len) {
+    if (fd < 0) return;
+
+    char buf[sizeof(struct record) + 256];
+    struct record* record = (struct record*)buf;
+    if (len > sizeof(buf) - sizeof(struct record)) len = sizeof(buf) - sizeof(struct record);
+    record->type = type;
+    record->len = len;
+    record->pid = pid;
+    record->value = value;
+    record->time = monotonic_ns() - started;
+    if (len > 0) memcpy(&buf[sizeof(struct record)], payload, len);
+    if (write(fd, buf, sizeof(struct record) + len) != (ssize_t)(sizeof(struct record) + len)) {
+        // a partial record would make the rest unreadable, stop here
+        LOGD("record: write failed [%d]", errno);
+        close(fd);
+        fd = -1;
+    }
+}
+
+void record_wait(pid_t pid, int status) {
+    append(RECORD_WAIT, pid, status, NULL, 0);
+}
+
+void record_eventmsg(pid_t pid, unsigned long msg) {
+    append(RECORD_EVENTMSG, pid, (int64_t)msg, NULL, 0);
+}
+
+void record_package(pid_t pid, int detected, uid_t uid, const char* name) {
+    if (detected) {
+        append(RECORD_PACKAGE, pid, uid, name, strlen(name) + 1);
+    } else {
+        append(RECORD_PACKAGE, pid, -1, NULL, 0);
+    }
+}
+
+void record_submit(pid_t pid, pid_t helper) {
+    append(RECORD_SUBMIT, pid, helper, NULL, 0);
+}
+
+void record_collect(pid_t pid, unsigned int cookie, int unmounted, int failed, int skipped) {
+    struct record_unmount result = { unmounted, failed, skipped };
+    append(RECORD_COLLECT, pid, cookie, &result, sizeof(result));
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define RECORD_MAGIC 0x52484853 // "SHHR"
+#define RECORD_VERSION 2
+#define RECORD_TARGETS 4 // zygotes
+
+// header flags
+#define RECORD_SEIZED 1     // attached with PTRACE_SEIZE
+
+// record types, everything the ptrace backend's state machine reads from outside
+enum {
+    RECORD_WAIT = 1,    // waitpid() returned pid, value is the status
+    RECORD_EVENTMSG,    // PTRACE_GETEVENTMSG for pid, value is the message
+    RECORD_PACKAGE,     // detect_package() for pid, value is the uid or -1 if not detected,
+                        // the payload is the name if detected
+    RECORD_SUBMIT,      // unmount of pid started, value is the helper pid, 0 if on a worker
+    RECORD_COLLECT,     // unmount of pid completed on a worker, value is the cookie, the
+                        // payload is struct record_unmount
+    RECORD_TYPES
+};
+
+/* A recording is a struct record_header followed by records, each followed by len bytes of
+ * payload. Records are written as they happen, so a recording cut short by the tracer being
+ * killed is still valid up to its last complete record.
+ */
+struct record_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t count;     // zygotes in targets
+    int32_t targets[RECORD_TARGETS];
+    uint64_t started;   // CLOCK_MONOTONIC, ns
+};
+
+struct record {
+    uint16_t type;
+    uint16_t len;       // bytes of payload following this record
+    int32_t pid;
+    int64_t value;
+    uint64_t time;      // ns since started
+};
+
+struct record_unmount {
+    int32_t unmounted;
+    int32_t failed;
+    int32_t skipped;
+};
+
+int record_open(const char* path, const pid_t* targets, int count, int flags);
+void record_wait(pid_t pid, int status);
+void record_eventmsg(pid_t pid, unsigned long msg);
+void record_package(pid_t pid, int detected, uid_t uid, const char* name);
+void record_submit(pid_t pid, pid_t helper);
+void record_collect(pid_t pid, unsigned int cookie, int unmounted, int failed, int skipped);
+
+#endif
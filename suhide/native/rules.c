@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Unmount rules, deciding which mounts are root-related. Rules are read from RULESFILE if it
+ * exists, one per line:
+ *
+ *   <target|root|source> <exact|prefix|contains> <pattern> [fstype <fstype>]
+ *
+ * where target is the mount point, root is the mount's root within its filesystem (the source
+ * directory of a bind mount), and source is the mounted device. Patterns are matched against
+ * the raw mountinfo fields, so a space must be written as \040. Empty lines and lines starting
+ * with # are ignored. A mount is unmounted if any rule matches.
+ *
+ * All patterns for a field are compiled into a single Aho-Corasick automaton, so each field of
+ * a mountinfo line is classified in one pass regardless of the number of rules. Exact and
+ * prefix rules are matches that must start at the first character (and for exact, end at the
+ * last). Once built, the automaton is flattened into a transition table over byte classes
+ * (each byte used in a pattern, and everything else), so matching takes a single lookup per
+ * character.
+ *
+ * Compiled rules are reference counted, so worker threads can keep using a set while the
+ * tracer loads a newer one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "ndklog.h"
+#include "rules.h"
+
+#define RULESFILE "/sbin/supersu/suhide/" RULES_NAME
+
+// used if RULESFILE does not exist
+static const char* default_rules =
+    "target exact /sbin\n"
+    "target prefix /sbin/\n"
+    "target exact /root/sbin\n"
+    "target prefix /root/sbin/\n"
+    "target exact /data/adb/su\n"
+    "target prefix /data/adb/su/\n"
+    "root contains /adb/su\n"
+    "target contains /system/\n"
+    "target contains /vendor/\n"
+    "target contains /original/\n"
+    "target exact /system fstype tmpfs\n"
+    "target exact /vendor fstype tmpfs\n"
+    "target exact /oem fstype tmpfs\n"
+    "target exact /odm fstype tmpfs\n";
+
+enum { FIELD_TARGET, FIELD_ROOT, FIELD_SOURCE, FIELD_COUNT };
+enum { MATCH_EXACT, MATCH_PREFIX, MATCH_CONTAINS };
+
+struct rule {
+    int match;
+    int length;     // pattern length
+    char* fstype;   // NULL for any
+};
+
+// trie node, children are a linked list as rule sets are small and sparse
+struct node {
+    int child;      // first child, 0 for none (root is never a child)
+    int sibling;    // next sibling, 0 for none
+    int fail;       // longest proper suffix that is also in the trie
+    int dict;       // nearest node in the fail chain that has outputs, 0 for none
+    int output;     // first output, -1 for none
+    unsigned char c;
+};
+
+// rule ending at a node
+struct output {
+    int rule;
+    int next;       // -1 for none
+};
+
+struct automaton {
+    struct node* nodes;
+    int node_count;
+    int node_capacity;
+    struct output* outputs;
+    int output_count;
+    int output_capacity;
+    unsigned char classes[256]; // byte class of each byte, 0 for bytes in no pattern
+    int class_count;
+    int* delta;     // next node for each node and byte class, node_count * class_count. Stored
+                    // as the offset of its row shifted left by one, the low bit is set if any
+                    // rule may end at that node
+};
+
+struct rules {
+    int refs;
+    time_t mtime;
+    struct rule* rules;
+    int rule_count;
+    int rule_capacity;
+    struct automaton fields[FIELD_COUNT];
+};
+
+// currently loaded rules, holds one reference
+static struct rules* current = NULL;
+
+// rules loaded by the config watcher that rules_load() has not picked up yet, holds one reference
+static struct rules* pending = NULL;
+
+// is RULESFILE watched ? see rules_watched()
+static int watched = 0;
+
+// find c among node's children, returns 0 if not present
+static int child(const struct automaton* a, int node, unsigned char c) {
+    for (int n = a->nodes[node].child; n != 0; n = a->nodes[n].sibling) {
+        if (a->nodes[n].c == c) return n;
+    }
+    return 0;
+}
+
+// add a node to the automaton, returns its index or -1
+static int add_node(struct automaton* a, unsigned char c) {
+    if (a->node_count == a->node_capacity) {
+        int capacity = a->node_capacity ? a->node_capacity * 2 : 64;
+        struct node* nodes = (struct node*)realloc(a->nodes, sizeof(struct node) * capacity);
+        if (nodes == NULL) return -1;
+        a->nodes = nodes;
+        a->node_capacity = capacity;
+    }
+    struct node* node = &a->nodes[a->node_count];
+    memset(node, 0, sizeof(*node));
+    node->output = -1;
+    node->c = c;
+    return a->node_count++;
+}
+
+// insert pattern for rule into the trie, returns 0 on success
+static int insert(struct automaton* a, const char* pattern, int rule) {
+    if ((a->node_count == 0) && (add_node(a, 0) != 0)) return 1;
+
+    int node = 0;
+    for (const unsigned char* p = (const unsigned char*)pattern; *p != '\0'; p++) {
+        int next = child(a, node, *p);
+        if (next == 0) {
+            next = add_node(a, *p);
+            if (next < 0) return 1;
+            a->nodes[next].sibling = a->nodes[node].child;
+            a->nodes[node].child = next;
+        }
+        node = next;
+    }
+
+    if (a->output_count == a->output_capacity) {
+        int capacity = a->output_capacity ? a->output_capacity * 2 : 16;
+        struct output* outputs = (struct output*)realloc(a->outputs, sizeof(struct output) * capacity);
+        if (outputs == NULL) return 1;
+        a->outputs = outputs;
+        a->output_capacity = capacity;
+    }
+    a->outputs[a->output_count].rule = rule;
+    a->outputs[a->output_count].next = a->nodes[node].output;
+    a->nodes[node].output = a->output_count++;
+    return 0;
+}
+
+// compute fail and dict links breadth-first, returns 0 on success
+static int build_links(struct automaton* a) {
+    if (a->node_count == 0) return 0;
+
+    int* queue = (int*)malloc(sizeof(int) * a->node_count);
+    if (queue == NULL) return 1;
+    int head = 0;
+    int tail = 0;
+    queue[tail++] = 0;
+    while (head < tail) {
+        int node = queue[head++];
+        for (int n = a->nodes[node].child; n != 0; n = a->nodes[n].sibling) {
+            int fail = 0;
+            if (node != 0) {
+                int f = a->nodes[node].fail;
+                while ((f != 0) && (child(a, f, a->nodes[n].c) == 0)) f = a->nodes[f].fail;
+                fail = child(a, f, a->nodes[n].c);
+            }
+            a->nodes[n].fail = fail;
+            a->nodes[n].dict = (a->nodes[fail].output >= 0) ? fail : a->nodes[fail].dict;
+            queue[tail++] = n;
+        }
+    }
+
+    // flatten into the transition table. In breadth-first order, a node's fail node always
+    // has its row filled in already
+    unsigned char bytes[256];
+    a->class_count = 1;
+    for (int n = 1; n < a->node_count; n++) {
+        unsigned char c = a->nodes[n].c;
+        if (a->classes[c] == 0) {
+            a->classes[c] = a->class_count;
+            bytes[a->class_count++] = c;
+        }
+    }
+    a->delta = (int*)calloc(a->node_count * a->class_count, sizeof(int));
+    if (a->delta == NULL) {
+        free(queue);
+        return 1;
+    }
+    for (int i = 0; i < tail; i++) {
+        int node = queue[i];
+        int* row = &a->delta[node * a->class_count];
+        for (int k = 1; k < a->class_count; k++) {
+            int next = child(a, node, bytes[k]);
+            if ((next == 0) && (node != 0)) {
+                row[k] = a->delta[a->nodes[node].fail * a->class_count + k];
+            } else {
+                row[k] = ((next * a->class_count) << 1) | ((a->nodes[next].output >= 0) || (a->nodes[next].dict != 0));
+            }
+        }
+    }
+    free(queue);
+    return 0;
+}
+
+// does any rule match string s of the given field ?
+static int match(const struct rules* rules, const struct automaton* a, const char* s, const char* fstype) {
+    if (a->node_count == 0) return 0;
+
+    int row = 0;
+    for (int i = 0; s[i] != '\0'; i++) {
+        int next = a->delta[row + a->classes[(unsigned char)s[i]]];
+        row = next >> 1;
+        if ((next & 1) == 0) continue;
+
+        for (int n = row / a->class_count; n != 0; n = a->nodes[n].dict) {
+            for (int o = a->nodes[n].output; o >= 0; o = a->outputs[o].next) {
+                const struct rule* rule = &rules->rules[a->outputs[o].rule];
+                int start = i + 1 - rule->length;
+                if ((rule->match != MATCH_CONTAINS) && (start != 0)) continue;
+                if ((rule->match == MATCH_EXACT) && (s[i + 1] != '\0')) continue;
+                if ((rule->fstype != NULL) && (strcmp(rule->fstype, fstype) != 0)) continue;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// free rules and everything it owns
+static void destroy(struct rules* rules) {
+    for (int i = 0; i < rules->rule_count; i++) {
+        free(rules->rules[i].fstype);
+    }
+    free(rules->rules);
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        free(rules->fields[i].nodes);
+        free(rules->fields[i].outputs);
+        free(rules->fields[i].delta);
+    }
+    free(rules);
+}
+
+// parse a single rule line (modified in place) and add it to rules, returns 0 on success or if
+// the line is empty or a comment
+static int parse_rule(struct rules* rules, char* line) {
+    char* save = NULL;
+    char* field = strtok_r(line, " \t\r", &save);
+    if ((field == NULL) || (field[0] == '#')) return 0;
+    char* type = strtok_r(NULL, " \t\r", &save);
+    char* pattern = strtok_r(NULL, " \t\r", &save);
+    char* key = strtok_r(NULL, " \t\r", &save);
+    char* fstype = strtok_r(NULL, " \t\r", &save);
+    if ((type == NULL) || (pattern == NULL)) return 1;
+    if ((key != NULL) && ((strcmp(key, "fstype") != 0) || (fstype == NULL))) return 1;
+
+    int f;
+    if (strcmp(field, "target") == 0) f = FIELD_TARGET;
+    else if (strcmp(field, "root") == 0) f = FIELD_ROOT;
+    else if (strcmp(field, "source") == 0) f = FIELD_SOURCE;
+    else return 1;
+
+    struct rule rule;
+    if (strcmp(type, "exact") == 0) rule.match = MATCH_EXACT;
+    else if (strcmp(type, "prefix") == 0) rule.match = MATCH_PREFIX;
+    else if (strcmp(type, "contains") == 0) rule.match = MATCH_CONTAINS;
+    else return 1;
+    rule.length = strlen(pattern);
+    rule.fstype = NULL;
+
+    if (rules->rule_count == rules->rule_capacity) {
+        int capacity = rules->rule_capacity ? rules->rule_capacity * 2 : 16;
+        struct rule* grown = (struct rule*)realloc(rules->rules, sizeof(struct rule) * capacity);
+        if (grown == NULL) return 1;
+        rules->rules = grown;
+        rules->rule_capacity = capacity;
+    }
+    if ((fstype != NULL) && ((rule.fstype = strdup(fstype)) == NULL)) return 1;
+    rules->rules[rules->rule_count] = rule;
+    if (insert(&rules->fields[f], pattern, rules->rule_count) != 0) {
+        free(rule.fstype);
+        return 1;
+    }
+    rules->rule_count++;
+    return 0;
+}
+
+// compile rules from text (modified in place), returns NULL on allocation failure
+static struct rules* compile(char* text) {
+    struct rules* rules = (struct rules*)calloc(1, sizeof(struct rules));
+    if (rules == NULL) return NULL;
+    rules->refs = 1;
+
+    char* save = NULL;
+    for (char* line = strtok_r(text, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+        if (parse_rule(rules, line) != 0) {
+            LOGD("rules: skipping invalid rule");
+        }
+    }
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        if (build_links(&rules->fields[i]) != 0) {
+            destroy(rules);
+            return NULL;
+        }
+    }
+    return rules;
+}
+
+// compile rules from RULESFILE, returns NULL if it cannot be read
+static struct rules* compile_file(off_t size) {
+    int fd = open(RULESFILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    char* buf = (char*)malloc(size + 1);
+    int buf_read = 0;
+    if (buf != NULL) {
+        while (buf_read < size) {
+            int r = read(fd, &buf[buf_read], size - buf_read);
+            if (r <= 0) break;
+            buf_read += r;
+        }
+        buf[buf_read] = '\0';
+    }
+    close(fd);
+
+    struct rules* rules = (buf != NULL) ? compile(buf) : NULL;
+    free(buf);
+    return rules;
+}
+
+// compile the rules from RULESFILE, or the defaults if it does not exist, with stat its
+// lstat() result (st_mtime 0 if missing). Returns NULL on allocation failure
+static struct rules* load(const struct stat* stat) {
+    struct rules* loaded = (stat->st_mtime != 0) ? compile_file(stat->st_size) : NULL;
+    if (loaded == NULL) {
+        char* text = strdup(default_rules);
+        if (text != NULL) {
+            loaded = compile(text);
+            free(text);
+        }
+    }
+    if (loaded != NULL) {
+        LOGD("rules: loaded %d", loaded->rule_count);
+        loaded->mtime = stat->st_mtime;
+    }
+    return loaded;
+}
+
+// lstat() RULESFILE, with st_mtime 0 if it does not exist
+static void stat_file(struct stat* stat) {
+    if (lstat(RULESFILE, stat) != 0) stat->st_mtime = 0;
+}
+
+// RULESFILE is watched by the config watcher (see config_watch_file()), which calls
+// rules_reload() on changes, so rules_load() no longer needs to check it
+void rules_watched() {
+    watched = 1;
+}
+
+// reload RULESFILE, called from the config watcher thread. Takes effect at the next rules_load()
+void rules_reload() {
+    struct stat stat;
+    stat_file(&stat);
+    struct rules* loaded = load(&stat);
+    if (loaded != NULL) rules_release(__atomic_exchange_n(&pending, loaded, __ATOMIC_ACQ_REL));
+}
+
+// get current rules, (re)loading them if RULESFILE has changed. The caller holds a reference
+// to the returned rules and must rules_release() it. Returns NULL on allocation failure
+struct rules* rules_load() {
+    struct rules* loaded = NULL;
+    if (watched && (current != NULL)) {
+        loaded = __atomic_exchange_n(&pending, NULL, __ATOMIC_ACQ_REL);
+    } else {
+        // first load, or not watched: check the file's mtime
+        struct stat stat;
+        stat_file(&stat);
+        if ((current == NULL) || (current->mtime != stat.st_mtime)) loaded = load(&stat);
+    }
+
+    if (loaded != NULL) {
+        if (current != NULL) rules_release(current);
+        current = loaded;
+    }
+
+    if (current != NULL) rules_acquire(current);
+    return current;
+}
+
+// take an additional reference to rules
+void rules_acquire(struct rules* rules) {
+    __sync_fetch_and_add(&rules->refs, 1);
+}
+
+// drop a reference to rules, freeing them when it was the last
+void rules_release(struct rules* rules) {
+    if ((rules != NULL) && (__sync_sub_and_fetch(&rules->refs, 1) == 0)) {
+        destroy(rules);
+    }
+}
+
+// does any rule match this mount ?
+int rules_match(const struct rules* rules, const struct mountinfo_entry* entry) {
+    if (rules == NULL) return 0;
+    return
+        match(rules, &rules->fields[FIELD_TARGET], entry->target, entry->fstype) ||
+        match(rules, &rules->fields[FIELD_ROOT], entry->root, entry->fstype) ||
+        match(rules, &rules->fields[FIELD_SOURCE], entry->source, entry->fstype);
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _RULES_H
+#define _RULES_H
+
+#include "mountinfo.h"
+
+// name of the rules file, in the same directory as the config (see config_watch_file())
+#define RULES_NAME "suhide.rules"
+
+struct rules;
+
+void rules_watched();
+void rules_reload();
+struct rules* rules_load();
+void rules_acquire(struct rules* rules);
+void rules_release(struct rules* rules);
+int rules_match(const struct rules* rules, const struct mountinfo_entry* entry);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Policy shared by the launcher with its suhide[32|64] children through a memfd, so the
+ * config is loaded and stored once, and tracers look policy up without any file I/O.
+ *
+ * The segment holds a header page and two slots, guarded by a sequence lock. The launcher is
+ * the only writer: it makes the generation odd, copies a new policy into the inactive slot,
+ * and makes the generation even again. The second lowest bit of the generation selects the
+ * active slot, which is never the one being written. Readers look up in the active slot, and
+ * retry if the generation changed meanwhile, as the slot may have been overwritten by a later
+ * publish. Lookups stay within the slot whatever they read (see policy.c), and the last byte
+ * of each slot is never written, so names are always terminated.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "ndklog.h"
+#include "policy.h"
+#include "sharedpolicy.h"
+
+// not in older headers
+#ifndef __NR_memfd_create
+#if defined(__aarch64__)
+#define __NR_memfd_create 279
+#elif defined(__arm__)
+#define __NR_memfd_create 385
+#elif defined(__x86_64__)
+#define __NR_memfd_create 319
+#elif defined(__i386__)
+#define __NR_memfd_create 356
+#elif defined(__mips__) && (_MIPS_SIM == _MIPS_SIM_ABI32)
+#define __NR_memfd_create 4354
+#elif defined(__mips__) && (_MIPS_SIM == _MIPS_SIM_ABI64)
+#define __NR_memfd_create 5314
+#elif defined(__mips__)
+#define __NR_memfd_create 6318
+#endif
+#endif
+
+#define HEADER_SIZE 4096
+#define SLOT_SIZE (1024 * 1024)
+#define SEGMENT_SIZE (HEADER_SIZE + 2 * SLOT_SIZE)
+
+struct segment {
+    uint32_t generation;    // odd while a slot is written, second lowest bit is the active slot,
+                            // below 2 if nothing was published
+};
+
+#define ACTIVE(generation) (((generation) >> 1) & 1)
+
+#define SLOT(segment, index) ((struct policy*)((char*)(segment) + HEADER_SIZE + (index) * SLOT_SIZE))
+
+// mapped segment, writable in the launcher and read-only in tracers
+static struct segment* segment = NULL;
+
+// create the segment, returns the fd to pass to children, or -1 on failure. The fd is
+// inherited across exec
+int sharedpolicy_create() {
+#ifdef __NR_memfd_create
+    int fd = syscall(__NR_memfd_create, "suhide.policy", 0);
+    if (fd < 0) return -1;
+
+    // only the pages written are allocated
+    if (ftruncate(fd, SEGMENT_SIZE) != 0) {
+        close(fd);
+        return -1;
+    }
+    void* data = mmap(NULL, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    segment = (struct segment*)data;
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+// publish a policy to all attached readers, returns 0 on success
+int sharedpolicy_publish(const struct policy* policy) {
+    if (segment == NULL) return 1;
+    if (policy->size > SLOT_SIZE - 1) {
+        LOGD("sharedpolicy: %u bytes does not fit", policy->size);
+        return 1;
+    }
+
+    // readers that see any of the copy also see the odd generation, and retry
+    uint32_t generation = __atomic_load_n(&segment->generation, __ATOMIC_RELAXED) + 2;
+    __atomic_store_n(&segment->generation, generation - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(SLOT(segment, ACTIVE(generation)), policy, policy->size);
+    __atomic_store_n(&segment->generation, generation, __ATOMIC_RELEASE);
+    LOGD("sharedpolicy: published generation %u", generation);
+    return 0;
+}
+
+// map the segment created by the launcher, returns 0 on success
+int sharedpolicy_attach(int fd) {
+    void* data = mmap(NULL, SEGMENT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return 1;
+    segment = (struct segment*)data;
+    return 0;
+}
+
+// is root access allowed for uid ?
+int sharedpolicy_allow_uid(uid_t uid) {
+    if (segment == NULL) return 1;
+    while (1) {
+        uint32_t generation = __atomic_load_n(&segment->generation, __ATOMIC_ACQUIRE);
+        if (generation < 2) return 1; // nothing published yet
+        int ret = policy_allow_uid(SLOT(segment, ACTIVE(generation)), SLOT_SIZE, uid);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&segment->generation, __ATOMIC_RELAXED) == generation) return ret;
+    }
+}
+
+// is root access allowed for process name ?
+int sharedpolicy_allow_name(const char* name) {
+    if (segment == NULL) return 1;
+    while (1) {
+        uint32_t generation = __atomic_load_n(&segment->generation, __ATOMIC_ACQUIRE);
+        if (generation < 2) return 1; // nothing published yet
+        int ret = policy_allow_name(SLOT(segment, ACTIVE(generation)), SLOT_SIZE, name);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&segment->generation, __ATOMIC_RELAXED) == generation) return ret;
+    }
+}
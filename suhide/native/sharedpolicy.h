@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _SHAREDPOLICY_H
+#define _SHAREDPOLICY_H
+
+#include <sys/types.h>
+
+#include "policy.h"
+
+int sharedpolicy_create();
+int sharedpolicy_publish(const struct policy* policy);
+int sharedpolicy_attach(int fd);
+int sharedpolicy_allow_uid(uid_t uid);
+int sharedpolicy_allow_name(const char* name);
+
+#endif
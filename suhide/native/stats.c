@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Counters and latency histograms, kept in a file mapped shared so they can be read by any
+ * tool while we run. If the file cannot be created they are still kept, just in memory.
+ * Only the main thread updates them.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "ndklog.h"
+#include "util.h"
+#include "stats.h"
+
+// used until (or if not) the file is mapped
+static struct stats fallback;
+
+static struct stats* stats = &fallback;
+
+// create and map the stats file, returns 0 on success
+int stats_open(const char* path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return 1;
+    if (ftruncate(fd, sizeof(struct stats)) != 0) {
+        close(fd);
+        return 1;
+    }
+    void* data = mmap(NULL, sizeof(struct stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return 1;
+
+    struct stats* mapped = (struct stats*)data;
+    memcpy(mapped, stats, sizeof(struct stats));
+    mapped->pid = getpid();
+    mapped->started = monotonic_ns();
+    mapped->version = STATS_VERSION;
+    __atomic_store_n(&mapped->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+    stats = mapped;
+    LOGD("stats: [%s]", path);
+    return 0;
+}
+
+static void store(uint64_t* field, uint64_t value) {
+    __atomic_store_n(field, value, __ATOMIC_RELAXED);
+}
+
+void stats_add(int counter, uint64_t value) {
+    store(&stats->counters[counter], stats->counters[counter] + value);
+}
+
+void stats_set(int counter, uint64_t value) {
+    if (stats->counters[counter] != value) store(&stats->counters[counter], value);
+}
+
+// record the latency between two timestamps, ignored if either was not taken
+void stats_record(int histogram, uint64_t start, uint64_t end) {
+    if ((start == 0) || (end < start)) return;
+    uint64_t latency = end - start;
+
+    int bucket = 0;
+    if (latency > 0) bucket = 63 - __builtin_clzll(latency);
+    if (bucket >= STATS_BUCKETS) bucket = STATS_BUCKETS - 1;
+
+    struct stats_histogram* h = &stats->histograms[histogram];
+    store(&h->buckets[bucket], h->buckets[bucket] + 1);
+    store(&h->sum, h->sum + latency);
+    if (latency > h->max) store(&h->max, latency);
+    store(&h->count, h->count + 1);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+
+#define STATS_MAGIC 0x54534853 // "SHST"
+#define STATS_VERSION 1
+
+// bucket i counts latencies of 2^i up to 2^(i+1) ns, bucket 0 includes 0
+#define STATS_BUCKETS 40
+
+// counters
+enum {
+    STATS_FORKS,            // zygote forks seen
+    STATS_CLONES,           // clones of those forks seen
+    STATS_DETECTED,         // apps identified
+    STATS_HIDDEN,           // apps root was hidden from
+    STATS_UNMOUNTED,        // successful unmounts
+    STATS_UNMOUNT_FAILURES, // failed unmounts
+    STATS_TRACED,           // threads currently traced (a gauge)
+    STATS_COUNTERS
+};
+
+// latency histograms
+enum {
+    STATS_DETECT,           // fork to package detection
+    STATS_QUEUE,            // package detection to unmount start
+    STATS_UNMOUNT,          // unmount start to end
+    STATS_DETACH,           // unmount end to detach
+    STATS_LAUNCH,           // fork to detach (or continue, for the proc connector backend)
+    STATS_HISTOGRAMS
+};
+
+struct stats_histogram {
+    uint64_t count;
+    uint64_t sum;           // ns
+    uint64_t max;           // ns
+    uint64_t buckets[STATS_BUCKETS];
+};
+
+/* Layout of the stats file, which is mapped shared and updated in place by a single thread.
+ * Every field is written atomically, but a reader may see a histogram between updates of
+ * its fields. Timestamps are CLOCK_MONOTONIC, in ns.
+ */
+struct stats {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pid;
+    uint32_t reserved;
+    uint64_t started;
+    uint64_t counters[STATS_COUNTERS];
+    struct stats_histogram histograms[STATS_HISTOGRAMS];
+};
+
+int stats_open(const char* path);
+void stats_add(int counter, uint64_t value);
+void stats_set(int counter, uint64_t value);
+void stats_record(int histogram, uint64_t start, uint64_t end);
+
+#endif
@@ -14,9 +14,11 @@
  * limitations under the License.
  */
 
-/* Main file for suhide[32|64]. This process attaches to zygote(64) and monitors forks and
- * clones. As soon as an app forks from zygote it checks if that app should have root or not,
- * and if necessary unmounts all root-related mounts.
+/* Main file for suhide[32|64]. This process attaches to zygote and zygote64 and monitors forks
+ * and clones. A single (64-bit where available) process services all zygotes from one loop;
+ * everything that differs per zygote is looked up through the app's tracee entry. As soon as
+ * an app forks from zygote it checks if that app should have root or not, and if necessary
+ * unmounts all root-related mounts.
  *
  * All of this is based around PTRACE, though it is not architecture-specific. PTRACE is
  * tricky to work with, and there are many odd edge-cases. The current code has been
@@ -26,168 +28,594 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <poll.h>
 #include <sys/ptrace.h>
-#include <sys/stat.h>
 #include <sys/wait.h>
-#include <sys/syscall.h>
-#include <sched.h>
-#include <sys/mount.h>
 
 #include "ndklog.h"
 #include "util.h"
 #include "trace.h"
 #include "config.h"
+#include "procconn.h"
+#include "pidtable.h"
+#include "unmount.h"
+#include "nsworker.h"
+#include "rules.h"
+#include "plan.h"
+#include "stats.h"
+#include "eventlog.h"
+#include "package.h"
+#include "record.h"
 
-// unmount all root-related mounts from pid; done by forking a child which enters the target's
-// namespace, enumerates mounts, and unmounts the non-standard ones
-static void unmount_root(char* name, pid_t zygote, pid_t pid) {
-    pid_t child = fork();
-    if (child == 0) {
-        // child
-        char path1[PATH_MAX];
-        char path2[PATH_MAX];
-        char ns1[PATH_MAX];
-        char ns2[PATH_MAX];
-        snprintf(path1, PATH_MAX, "/proc/%d/ns/mnt", zygote);
-        snprintf(path2, PATH_MAX, "/proc/%d/ns/mnt", pid);
-        ssize_t len1 = readlink(path1, ns1, PATH_MAX);
-        ssize_t len2 = readlink(path2, ns2, PATH_MAX);
-        if ((len1 > 0) && (len2 > 0)) {
-            ns1[len1] = '\0';
-            ns2[len2] = '\0';
-            if (strcmp(ns1, ns2) != 0) {
-                // we truly have different namespaces
-                int nsfd = open(path2, O_RDONLY);
-                if (nsfd >= 0) {
-                    if (syscall(__NR_setns, nsfd, CLONE_NEWNS) == 0) {
-                        // read mounts
-
-                        int fd = open("/proc/self/mountinfo", O_RDONLY);
-                        if (fd >= 0) {
-                            char buf[32768];
-                            int total = 0;
-                            int size = 32768;
-                            while (1) {
-                                int r = read(fd, &buf[total], size - total);
-                                if (r <= 0) break;
-                                total += r;
-                            }
-                            close(fd);
-
-                            if (total > 0) {
-                                char* start = buf;
-                                for (int i = 0; i < total; i++) {
-                                    if (buf[i] == '\n') {
-                                        buf[i] = '\0';
-
-                                        char p1[PATH_MAX];
-                                        char p2[PATH_MAX];
-                                        char p3[PATH_MAX];
-                                        char source[PATH_MAX];
-                                        char target[PATH_MAX];
-                                        char p6[PATH_MAX];
-                                        char p7[PATH_MAX];
-                                        char p8[PATH_MAX];
-                                        char fs[PATH_MAX];
-
-                                        if (sscanf(start, "%s %s %s %s %s %s %s %s %s", p1, p2, p3, source, target, p6, p7, p8, fs) == 9) {
-                                            if (
-                                                (strcmp(target, "/sbin") == 0) ||
-                                                (strncmp(target, "/sbin/", 6) == 0) ||
-                                                (strcmp(target, "/root/sbin") == 0) ||
-                                                (strncmp(target, "/root/sbin/", 11) == 0) ||
-                                                (strcmp(target, "/data/adb/su") == 0) ||  //TODO readlink /sbin/supersu ?
-                                                (strncmp(target, "/data/adb/su/", 13) == 0) ||
-                                                (strstr(source, "/adb/su") != NULL) ||
-                                                (strstr(target, "/system/") != NULL) ||
-                                                (strstr(target, "/vendor/") != NULL) ||
-                                                (strstr(target, "/original/") != NULL) ||
-                                                (
-                                                    (
-                                                        (strcmp(fs, "tmpfs") == 0)
-                                                    ) && (
-                                                        (strcmp(target, "/system") == 0) ||
-                                                        (strcmp(target, "/vendor") == 0) ||
-                                                        (strcmp(target, "/oem") == 0) ||
-                                                        (strcmp(target, "/odm") == 0)
-                                                    )
-                                                )
-                                            ) {
-                                                if (umount2(target, MNT_DETACH) == 0) {
-                                                    LOGD("[%d] [%s] unmounted", pid, target);
-                                                } else {
-                                                    LOGD("[%d] [%s] unmount failed", pid, target);
-                                                }
-                                            }
-                                        }
+// counters and latency histograms, see stats.h. Kept where the default rules unmount it for
+// hidden apps, and only readable by root, so it cannot give suhide away
+#define STATS_PATH "/sbin/supersu/suhide/" LOG_TAG ".stats"
 
-                                        start = &buf[i + 1];
-                                    }
-                                }
-                            } else {
-                                LOGD("[%d] empty read from mountinfo", pid);
-                            }
-                        } else {
-                            LOGD("[%d] failed to read mountinfo", pid);
-                        }
-                    } else {
-                        LOGD("[%d] failed to join namespace", pid);
-                    }
-                    close(nsfd);
-                } else {
-                    LOGD("[%d] failed to join namespace", pid);
-                }
-            }
-        }
-        exit(EXIT_SUCCESS);
-    } else {
-        // parent
-        waitpid(child, NULL, 0);
+// binary event log, see eventlog.h and suhide_events. Root-only, next to the stats file
+#define EVENTS_PATH "/sbin/supersu/suhide/" LOG_TAG ".events"
+
+// recording of the ptrace backend's inputs, only if this file exists, see record.h
+#define RECORD_PATH "/dev/." LOG_TAG ".record"
+
+// ptrace options for zygote, its forks inherit them
+#define TRACE_OPTIONS ( \
+    PTRACE_O_TRACECLONE | \
+/*  PTRACE_O_TRACEEXEC | #do not want */ \
+    PTRACE_O_TRACEEXIT | \
+    PTRACE_O_TRACEFORK | \
+/*  PTRACE_O_TRACESYSGOOD | #do not want */ \
+    PTRACE_O_TRACEVFORK /* | */ \
+/*  PTRACE_O_TRACEVFORKDONE | #do not want */ \
+/*  PTRACE_O_TRACESECCOMP | #do not want */ \
+/*  PTRACE_O_SUSPEND_SECCOMP #do not want and does not exist in headers */ \
+)
+
+// zygotes, which we're monitoring
+#define MAX_ZYGOTES 4
+static struct proc_handle zygotes[MAX_ZYGOTES];
+static int zygote_count = 0;
+
+// attached with PTRACE_SEIZE rather than PTRACE_ATTACH ?
+static int seized = 0;
+
+// how long a new tracee is held stopped waiting for its parent's fork or clone event
+#define EARLY_TIMEOUT_MS 1000
+
+// monotonic_ns() at which the oldest early tracee times out, 0 if none are held
+static uint64_t early_expires = 0;
+
+// returns the index of pid in zygotes, or -1 if it is not one of them
+static int zygote_index(pid_t pid) {
+    for (int i = 0; i < zygote_count; i++) {
+        if (zygotes[i].pid == pid) return i;
+    }
+    return -1;
+}
+
+// is name that of a secondary zygote ? webview_zygote, and app zygotes which are named after
+// the app's process with "_zygote" appended (see ZygoteProcess.java). Their forks are apps too.
+static int is_secondary_zygote(const char* name) {
+    size_t len = strlen(name);
+    return (len > 7) && (strcmp(name + len - 7, "_zygote") == 0);
+}
+
+// zygote whose mounts app's namespace was copied from: the secondary zygote it was forked from if
+// still around, otherwise the zygote that was forked from in turn
+static const struct proc_handle* zygote_of(const struct tracee* app) {
+    if (app->server != 0) {
+        struct tracee* server = pidtable_get(app->server);
+        if ((server != NULL) && server->secondary) return &server->proc;
     }
+    return &zygotes[app->zygote];
 }
 
 // detects if a pid (that has been forked/cloned from zygote) has changed its name to its
 // final form (usually based on package name), check if that package is supposed to have root,
-// and if not, unmount root-related mounts from its namespace.
-static int detect_package_and_unmount(int pid, int zygote) {
-    char path[PATH_MAX];
-    struct stat stat;
-    snprintf(path, PATH_MAX, "/proc/%d/task", pid);
-    lstat(path, &stat);
-    if (stat.st_uid == 0) return 0;
-
-    char cmdline[128];
-    snprintf(path, PATH_MAX, "/proc/%d/cmdline", pid);
-    int fd = open(path, O_RDONLY);
-    if (fd >= 0) {
-        int len = read(fd, cmdline, 128);
-        if ((len > 0) && (len < 128)) {
-            cmdline[len] = '\0';
-            for (int i = 0; i < len; i++) {
-                if ((cmdline[i] == ' ') || (cmdline[i] == ':') || (cmdline[i] == '\0')) {
-                    cmdline[i] = '\0';
-                    break;
-                }
-            }
+// and if not, set hide so the caller unmounts root-related mounts from its namespace. The
+// name is returned in cmdline (128 bytes).
+static int detect_package_and_policy(const struct proc_handle* proc, uint32_t inherited, char* cmdline, int* hide) {
+    *hide = 0;
+    uid_t uid;
+    if (detect_package(proc, inherited, cmdline, &uid)) {
+        // Just after the name change and namespace unshare happen, zygote is still single-threaded,
+        // but an Android app never is. This code here is executed when the second thread is created.
+
+        LOGD("[%d] forked [%s] (%d)", proc->pid, cmdline, uid);
+
+        load_config();
+        if (!allow_root_for_uid(uid) || !allow_root_for_name(cmdline)) {
+            *hide = 1;
         }
+        return 1;
+    }
+    return 0;
+}
+
+// start unmounting leader's namespace on a worker, or on a forked helper if no worker is
+// available, and keep the thread pid that triggered detection stopped until it is done. Returns
+// 0 if started, 1 if nothing is pending and the caller should finish up right away
+static int start_unmount(pid_t pid, pid_t leader) {
+    struct tracee* app = pidtable_get(leader);
+    if (app == NULL) return 1;
+    unsigned int generation = app->generation;
+
+    struct rules* rules = rules_load();
+    const struct proc_handle* zygote = zygote_of(app);
+    struct plan* plan = plan_get(zygote, rules);
+    int submitted = nsworker_submit(zygote, &app->proc, rules, plan, generation) == 0;
+    eventlog_write(EVENTLOG_UNMOUNT_START, leader, 0, !submitted, 0, 0);
+    pid_t helper = submitted ? 0 : unmount_root_async(zygote, &app->proc, rules, plan);
+    record_submit(leader, helper);
+    plan_release(plan);
+    rules_release(rules);
+
+    if (!submitted) {
+        struct tracee* job = (helper > 0) ? pidtable_add(helper) : NULL;
+        if (job == NULL) {
+            if (helper > 0) waitpid(helper, NULL, 0);
+            return 1;
+        }
+        job->helper = 1;
+        pidtable_join(job, leader);
+        app = pidtable_get(leader);
+    }
+
+    app->unmounting = 1;
+    app->resume = pid;
+    return 0;
+}
+
+// continue the threads of leader that were kept stopped during its unmount
+static void resume_held(pid_t leader) {
+    int iter = 0;
+    struct tracee* tracee;
+    while ((tracee = pidtable_next(&iter)) != NULL) {
+        if (tracee->held && (pidtable_leader(tracee) == leader)) {
+            tracee->held = 0;
+            trace(PTRACE_CONT, tracee->pid, NULL, 0);
+        }
+    }
+}
+
+// continue the thread that triggered detection and detach from all of leader's threads, unless
+// leader is a secondary zygote which we keep tracing to follow its forks
+static void finish_package(pid_t pid, pid_t leader) {
+    struct tracee* app = pidtable_get(leader);
+    if ((app != NULL) && app->secondary) {
+        app->unmounting = 0;
+        stats_record(STATS_LAUNCH, app->forked_at, monotonic_ns());
+        trace(PTRACE_CONT, pid, NULL, 0);
+        resume_held(leader);
+        return;
+    }
+    int procfd = (app != NULL) ? app->proc.procfd : -1;
+    if (seized) {
+        // no need to continue pid first, detach_seized() detaches it right where it is stopped
+        detach_seized(leader, procfd);
+    } else if (trace(PTRACE_CONT, pid, NULL, 0) != ESRCH) {
+        detach_pid(leader, procfd);
+    }
+    if (app != NULL) stats_record(STATS_LAUNCH, app->forked_at, monotonic_ns());
+    eventlog_write(EVENTLOG_DETACH, leader, 0, 0, 0, 0);
+    pidtable_remove_group(leader);
+}
+
+// is pid part of an app whose unmount is still in progress ?
+static int unmount_pending(pid_t pid) {
+    struct tracee* leader = pidtable_get(pidtable_leader(pidtable_get(pid)));
+    return (leader != NULL) && leader->unmounting;
+}
+
+// handle the initial stop of a new fork or clone, returns the signal to continue it with, or
+// -1 to keep it stopped
+static int first_stop(pid_t pid, struct tracee* tracee) {
+    tracee->first_stop = 0;
+    if (tracee->forked) {
+        // we don't want forks of our forks to be traced, but we do want clones (threads), and
+        // forks of secondary zygotes
+        struct tracee* leader = pidtable_get(pidtable_leader(tracee));
+        if ((leader != NULL) && leader->secondary) {
+            trace(PTRACE_SETOPTIONS, pid, NULL, TRACE_OPTIONS);
+            tracee->fork_traced = 1;
+        } else {
+            trace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACECLONE);
+        }
+
+        // new thread of an app that is being unmounted, keep it stopped
+        // until detach
+        if (unmount_pending(pid)) {
+            tracee->held = 1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// keep tracing secondary zygote leader after detection, and follow its forks like those of
+// zygote. pid is the stopped thread that triggered detection; threads created from now on
+// inherit its options, other existing threads get them at their next stop
+static void promote_secondary(pid_t pid, pid_t leader, const char* name) {
+    struct tracee* server = pidtable_get(leader);
+    if (server == NULL) return;
+    LOGD("[%d] secondary zygote [%s]", leader, name);
+    server->secondary = 1;
+    server->inherited = package_hash(name);
+    eventlog_write(EVENTLOG_SECONDARY, leader, 0, 0, 0, zygotes[server->zygote].pid);
+    struct tracee* thread = pidtable_get(pid);
+    if ((thread != NULL) && (trace(PTRACE_SETOPTIONS, pid, NULL, TRACE_OPTIONS) == 0)) {
+        thread->fork_traced = 1;
+    }
+}
+
+// set up tracee (a new entry for pid) as a fork of a zygote, or of secondary zygote server if
+// not 0, whose name hashes to inherited
+static void add_fork(pid_t pid, struct tracee* tracee, int zygote, pid_t server, uint32_t inherited) {
+    stats_add(STATS_FORKS, 1);
+    tracee->zygote = zygote;
+    tracee->server = server;
+    tracee->inherited = inherited;
+    tracee->forked_at = monotonic_ns();
+    tracee->forked = 1;
+    tracee->leader = pid;
+    tracee->leader_generation = tracee->generation;
+    proc_handle_open(&tracee->proc, pid);
+}
+
+// add an unmount's outcome to the stats and event log
+static void record_unmount(pid_t pid, const struct unmount_result* result) {
+    eventlog_write(EVENTLOG_UNMOUNT_DONE, pid, 0, result->failed > 0, 0, result->unmounted);
+    stats_add(STATS_UNMOUNTED, result->unmounted);
+    stats_add(STATS_UNMOUNT_FAILURES, result->failed);
+    stats_record(STATS_UNMOUNT, result->started, result->finished);
+}
+
+// has the procconn thread its own filesystem context, so it can unmount_root() itself ?
+static int unshared_fs = 0;
+
+// stop pid, unmount root-related mounts from its namespace, and continue it. Returns 1 if we
+// could not return to our own namespace afterwards
+static int freeze_and_unmount(const struct proc_handle* zygote, const struct proc_handle* app) {
+    LOGD("[%d] freezing", app->pid);
+    int ret = 0;
+    if (proc_handle_kill(app, SIGSTOP) == 0) {
+        eventlog_write(EVENTLOG_UNMOUNT_START, app->pid, 0, 0, 0, 0);
+        struct unmount_result result;
+        struct rules* rules = rules_load();
+        struct plan* plan = plan_get(zygote, rules);
+        if (unshared_fs) {
+            ret = unmount_root(zygote, app, rules, plan, &result);
+        } else {
+            // the helper's outcome is not reported back, only its timing
+            memset(&result, 0, sizeof(result));
+            result.started = monotonic_ns();
+            pid_t helper = unmount_root_async(zygote, app, rules, plan);
+            if (helper > 0) waitpid(helper, NULL, 0);
+            result.finished = monotonic_ns();
+        }
+        plan_release(plan);
+        rules_release(rules);
+        proc_handle_kill(app, SIGCONT);
+        record_unmount(app->pid, &result);
+    }
+    return ret;
+}
+
+// stop app as soon as it is detected, and queue the unmount of its namespace on a worker, which
+// collect_unmounts() continues it after. Returns 0 if queued, 1 if the caller should unmount
+// with freeze_and_unmount() instead
+static int freeze_and_submit(struct tracee* app) {
+    LOGD("[%d] freezing", app->pid);
+    if (proc_handle_kill(&app->proc, SIGSTOP) != 0) return 1;
+    struct rules* rules = rules_load();
+    const struct proc_handle* zygote = zygote_of(app);
+    struct plan* plan = plan_get(zygote, rules);
+    int ret = nsworker_submit(zygote, &app->proc, rules, plan, app->generation);
+    plan_release(plan);
+    rules_release(rules);
+    if (ret != 0) return 1;
+    eventlog_write(EVENTLOG_UNMOUNT_START, app->pid, 0, 0, 0, 0);
+    app->unmounting = 1;
+    return 0;
+}
+
+// continue the apps whose unmount a worker has finished, and stop following them unless they
+// are secondary zygotes
+static void collect_unmounts() {
+    struct nsworker_result completed;
+    while (nsworker_collect(&completed)) {
+        LOGD("[%d] unmount done: %d unmounted, %d failed, %d skipped", completed.pid, completed.result.unmounted, completed.result.failed, completed.result.skipped);
+        record_unmount(completed.pid, &completed.result);
+        struct tracee* app = pidtable_get(completed.pid);
+        if ((app != NULL) && (app->generation == completed.cookie) && app->unmounting) {
+            stats_record(STATS_QUEUE, app->detected_at, completed.result.started);
+            stats_record(STATS_DETACH, completed.result.finished, monotonic_ns());
+            proc_handle_kill(&app->proc, SIGCONT);
+            stats_record(STATS_LAUNCH, app->forked_at, monotonic_ns());
+            app->unmounting = 0;
+            if (!app->secondary) pidtable_remove(completed.pid);
+        }
+    }
+}
+
+// keep config and rules lookups off the filesystem, the config itself is only watched if
+// not shared
+static void watch_config() {
+    config_watch_file(RULES_NAME, rules_reload);
+    if (config_watch() == 0) rules_watched();
+}
+
+// read pid's thread group and parent process from /proc, returns 0 on success
+static int read_parent(pid_t pid, pid_t* tgid, pid_t* ppid) {
+    char path[64];
+    char buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 1;
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return 1;
+    buf[len] = '\0';
+    char* tgid_line = strstr(buf, "\nTgid:");
+    char* ppid_line = strstr(buf, "\nPPid:");
+    if ((tgid_line == NULL) || (ppid_line == NULL)) return 1;
+    *tgid = atoi(tgid_line + 6);
+    *ppid = atoi(ppid_line + 6);
+    return 0;
+}
+
+// can a fork or clone event for pid, stopped by SIGSTOP without a pidtable entry, still
+// arrive ? Only if it was created by a zygote, a tracked secondary zygote, or a thread of a
+// tracked fork. Zygote itself, or a thread left behind when its group was detached, is not
+static int may_be_early(pid_t pid) {
+    if (zygote_index(pid) >= 0) return 0;
+    pid_t tgid;
+    pid_t ppid;
+    if (read_parent(pid, &tgid, &ppid) != 0) return 0;
+    if (tgid != pid) {
+        // new thread
+        if (zygote_index(tgid) >= 0) return 1;
+        struct tracee* leader = pidtable_get(tgid);
+        return (leader != NULL) && leader->forked && (leader->leader == tgid);
+    }
+    // new process
+    if (zygote_index(ppid) >= 0) return 1;
+    struct tracee* server = pidtable_get(ppid);
+    return (server != NULL) && server->secondary;
+}
+
+// continue early tracees whose fork or clone event did not arrive in time, for example because
+// the parent was killed before reporting it, and drop them. Only runs once the oldest is due
+static void expire_early() {
+    uint64_t now = monotonic_ns();
+    if ((early_expires == 0) || (now < early_expires)) return;
+    early_expires = 0;
+    int iter = 0;
+    struct tracee* tracee;
+    while ((tracee = pidtable_next(&iter)) != NULL) {
+        if (!tracee->early) continue;
+        uint64_t expires = tracee->forked_at + EARLY_TIMEOUT_MS * 1000000ULL;
+        if (now >= expires) {
+            LOGD("[%d] early stop expired", tracee->pid);
+            trace(PTRACE_CONT, tracee->pid, NULL, 0);
+            pidtable_remove(tracee->pid);
+        } else if ((early_expires == 0) || (expires < early_expires)) {
+            early_expires = expires;
+        }
+    }
+}
+
+// remove pid from the pidtable, and the plan cached for it if it is a secondary zygote
+static void remove_tracee(pid_t pid) {
+    struct tracee* tracee = pidtable_get(pid);
+    if ((tracee != NULL) && tracee->secondary) plan_forget(&tracee->proc);
+    pidtable_remove(pid);
+}
+
+// drop pending children that died without us seeing their exit event, returns 0 if all
+// zygotes are still alive. Exits are read from the pidfds a batch at a time
+static int sweep_pending() {
+    const struct proc_handle* handles[PROC_HANDLE_BATCH];
+    unsigned char exited[PROC_HANDLE_BATCH];
+    int iter = 0;
+    int count = PROC_HANDLE_BATCH;
+    while (count == PROC_HANDLE_BATCH) {
+        struct tracee* tracee;
+        count = 0;
+        while ((count < PROC_HANDLE_BATCH) && ((tracee = pidtable_next(&iter)) != NULL)) {
+            handles[count++] = &tracee->proc;
+        }
+        proc_handle_exited(handles, count, exited);
+        for (int i = 0; i < count; i++) {
+            if (exited[i]) remove_tracee(handles[i]->pid);
+        }
+    }
+    for (int i = 0; i < zygote_count; i++) handles[i] = &zygotes[i];
+    proc_handle_exited(handles, zygote_count, exited);
+    for (int i = 0; i < zygote_count; i++) {
+        if (exited[i]) return 1;
+    }
+    return 0;
+}
+
+// proc connector backend: follows zygote's children through kernel events rather than tracing
+// them, so zygote and its children never take ptrace stops. A child is only stopped once its
+// uid or name resolves to one root should be hidden from, and is continued as soon as a worker
+// has finished unmount_root(). Note that unlike the ptrace backend there is a window between
+// specialization and the stop in which the child runs with root mounts present: the kernel
+// reports the uid change or rename only after it happened, and the event still has to reach
+// us. An app that looks at its mounts right away can see them, more so while many apps start.
+static int procconn_main() {
+    int fd = procconn_open();
+    if (fd < 0) {
+        LOGD("Proc connector unavailable [%d]", errno);
+        return 1;
+    }
+    if ((sweep_pending() != 0) || (unmount_init() != 0)) {
         close(fd);
+        return 1;
+    }
+    LOGD("Following %d zygotes", zygote_count);
 
-        if ((strcmp(cmdline, "zygote") != 0) && (strcmp(cmdline, "zygote64") != 0) && (strncmp(cmdline, "<", 1) != 0)) {
-            // Name has been prettified at this point, (see com_android_internal_os_Zygote.cpp::setThreadName() or
-            // ZygoteConnection.java::handleChildProc()).
-            // The process's mount namespace should already be private (see com_android_internal_os_Zygote.cpp::MountEmulatedStorage()).
-            // Just after those two things happen, zygote is still single-threaded, but an Android
-            // app never is. This code here is executed when the second thread is created.
+    // unmount on workers, so reading events never waits for an unmount. Started before the
+    // watcher so it inherits their signal mask
+    nsworker_start(NSWORKER_COUNT);
+    watch_config();
+
+    // without a worker unmount_root() runs on this thread, and setns(CLONE_NEWNS) fails while
+    // the filesystem context is shared with the watcher thread. Unshared after starting the
+    // watcher, as new threads share the creating thread's context
+    unshared_fs = (unshare(CLONE_FS) == 0);
+    if (!unshared_fs) LOGD("unshare failed [%d], unmounting from helpers", errno);
+
+    // zygote children that have not been identified yet are kept in the pidtable
+    struct procconn_event event;
+    while (1) {
+        struct pollfd fds[2] = { { fd, POLLIN, 0 }, { nsworker_fd(), POLLIN, 0 } };
+        if ((poll(fds, 2, -1) < 0) && (errno != EINTR)) break;
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            read(fds[1].fd, &count, sizeof(count));
+            collect_unmounts();
+        }
+        if (fds[0].revents == 0) continue;
+
+        int r = procconn_read(fd, &event);
+        if (r < 0) break;
+        if (r == 2) {
+            // events were dropped, we may have missed exits
+            if (sweep_pending() != 0) break;
+            continue;
+        }
+        if (r == 0) continue;
 
-            LOGD("[%d] forked [%s] (%d)", pid, cmdline, stat.st_uid);
+        struct tracee* app = pidtable_get(event.tgid);
+        int detected = 0;
+        char cmdline[128];
+        uid_t uid;
+        if ((app != NULL) && (app->secondary || app->unmounting)) {
+            // secondary zygote, or stopped until its unmount is done: its own threads and name
+            // changes are of no interest
+            if ((event.what == PROC_EVENT_EXIT) && (event.pid == event.tgid))
+                remove_tracee(event.tgid);
+            continue;
+        }
+        if (event.what == PROC_EVENT_FORK) {
+            int zygote = zygote_index(event.parent_tgid);
+            struct tracee* server = (zygote < 0) ? pidtable_get(event.parent_tgid) : NULL;
+            if ((server != NULL) && !server->secondary) server = NULL;
+            if (((zygote >= 0) || (server != NULL)) && (event.pid == event.tgid)) { // fork of a (secondary) zygote
+                eventlog_write(EVENTLOG_FORK, event.pid, 0, 0, 0, event.parent_tgid);
+                pid_t server_pid = (server != NULL) ? server->pid : 0;
+                uint32_t inherited = (server != NULL) ? server->inherited : 0;
+                if (server != NULL) zygote = server->zygote;
+                // pidtable_add() may grow the table, server is invalid past this point
+                struct tracee* child = pidtable_add(event.pid);
+                if (child != NULL) add_fork(event.pid, child, zygote, server_pid, inherited);
+            } else if ((app != NULL) && (event.pid != event.tgid)) { // clone of fork
+                stats_add(STATS_CLONES, 1);
+                eventlog_write(EVENTLOG_CLONE, event.pid, 0, 0, 0, event.tgid);
+                detected = detect_package(&app->proc, app->inherited, cmdline, &uid);
+            }
+        } else if ((event.what == PROC_EVENT_UID) && (app != NULL)) {
+            // uid is dropped after the namespace has been unshared, so we can act right away
+            // if the uid is hidden; otherwise we still need the name
+            load_config();
+            if (!allow_root_for_uid(event.uid)) {
+                LOGD("[%d] uid detected (%d)", event.tgid, event.uid);
+                app->detected_at = monotonic_ns();
+                stats_add(STATS_DETECTED, 1);
+                stats_add(STATS_HIDDEN, 1);
+                stats_record(STATS_DETECT, app->forked_at, app->detected_at);
+                eventlog_write(EVENTLOG_DETECT, event.tgid, 0, 1, 0, event.uid);
+                if (freeze_and_submit(app) != 0) {
+                    int stuck = freeze_and_unmount(zygote_of(app), &app->proc);
+                    stats_record(STATS_LAUNCH, app->forked_at, monotonic_ns());
+                    pidtable_remove(event.tgid);
+                    if (stuck) break;
+                }
+            }
+        } else if ((event.what == PROC_EVENT_COMM) && (app != NULL)) {
+            detected = detect_package(&app->proc, app->inherited, cmdline, &uid);
+        } else if (event.what == PROC_EVENT_EXIT) {
+            if (zygote_index(event.pid) >= 0)
+                break;
+            if ((app != NULL) && (event.pid == event.tgid))
+                pidtable_remove(event.tgid);
+        }
 
+        if (detected) {
+            LOGD("[%d] package detected [%s] (%d)", event.tgid, cmdline, uid);
+            app->detected_at = monotonic_ns();
+            stats_add(STATS_DETECTED, 1);
+            stats_record(STATS_DETECT, app->forked_at, app->detected_at);
             load_config();
-            if (!allow_root_for_uid(stat.st_uid) || !allow_root_for_name(cmdline)) {
-                unmount_root(cmdline, zygote, pid);
+            int stuck = 0;
+            int queued = 0;
+            int hide = !allow_root_for_uid(uid) || !allow_root_for_name(cmdline);
+            eventlog_write(EVENTLOG_DETECT, event.tgid, 0, hide, 0, uid);
+            if (hide) {
+                stats_add(STATS_HIDDEN, 1);
+                queued = freeze_and_submit(app) == 0;
+                if (!queued) {
+                    stuck = freeze_and_unmount(zygote_of(app), &app->proc);
+                    stats_record(STATS_LAUNCH, app->forked_at, monotonic_ns());
+                }
+            }
+            if (is_secondary_zygote(cmdline)) {
+                // keep it around to recognize its forks
+                LOGD("[%d] secondary zygote [%s]", event.tgid, cmdline);
+                app->secondary = 1;
+                app->inherited = package_hash(cmdline);
+                eventlog_write(EVENTLOG_SECONDARY, event.tgid, 0, 0, 0, zygotes[app->zygote].pid);
+            } else if (!queued) {
+                pidtable_remove(event.tgid);
             }
+            if (stuck) break;
+        }
+    }
+
+    close(fd);
+    LOGD("Stopped following");
+    return 0;
+}
+
+// attach to zygote pid and set its options, with PTRACE_SEIZE if seize, returns 0 on success
+static int attach(pid_t pid, int seize) {
+    if (seize) {
+        return trace(PTRACE_SEIZE, pid, NULL, TRACE_OPTIONS) != -1 ? 0 : 1;
+    }
+    if (trace(PTRACE_ATTACH, pid, NULL, 0) == -1) return 1;
+    wait_stop(pid);
+    trace(PTRACE_SETOPTIONS, pid, NULL, TRACE_OPTIONS);
+    trace(PTRACE_CONT, pid, NULL, 0);
+    return 0;
+}
+
+// attach to all zygotes in the same mode, returns 0 on success. Seizing does not stop them,
+// and makes new forks and clones start with PTRACE_EVENT_STOP rather than a SIGSTOP we have
+// to tell apart from real ones. It needs Linux 3.4+, if it fails we attach instead
+static int attach_all(int use_seize) {
+    for (int i = 0; i < zygote_count; i++) {
+        pid_t pid = zygotes[i].pid;
+        int failed;
+        if ((i == 0) && use_seize) {
+            seized = attach(pid, 1) == 0;
+            if (!seized) LOGD("Seize failed [%d], attaching instead", errno);
+            failed = !seized && (attach(pid, 0) != 0);
+        } else {
+            failed = attach(pid, seized) != 0;
+        }
+        if (failed) {
+            // exiting detaches us from the zygotes attached so far
+            LOGD("Attach to [%d] failed [%d]", pid, errno);
+            eventlog_write(EVENTLOG_ATTACH, pid, 0, 0, errno, 0);
             return 1;
         }
+        LOGD("Attached to [%d]", pid);
+        eventlog_write(EVENTLOG_ATTACH, pid, 0, seized, 0, 0);
     }
     return 0;
 }
@@ -195,54 +623,124 @@ static int detect_package_and_unmount(int pid, int zygote) {
 int main(int argc, char *argv[], char** envp) {
     (void)detach_tid; // prevent unused function error
 
-    if (argc != 2) {
-        LOGD("Usage: %s <pid>", LOG_TAG);
+    if ((argc < 2) || (argc > 4)) {
+        LOGD("Usage: %s <pid>[,<pid>...] [ptrace|seize|procconn] [policy fd]", LOG_TAG);
         return 1;
     }
-    pid_t target = atol(argv[1]);
-    if (target == 0) {
+
+    // one or more zygotes to monitor, separated by commas
+    char* pids = argv[1];
+    while ((*pids != '\0') && (zygote_count < MAX_ZYGOTES)) {
+        pid_t pid = strtol(pids, &pids, 10);
+        if ((pid <= 0) || ((*pids != ',') && (*pids != '\0'))) {
+            LOGD("Invalid pid passed [%s]", argv[1]);
+            return 1;
+        }
+        if (*pids == ',') pids++;
+        proc_handle_open(&zygotes[zygote_count++], pid);
+    }
+    if (zygote_count == 0) {
         LOGD("Invalid pid passed [%s]", argv[1]);
         return 1;
     }
+    int use_procconn = (argc >= 3) && (strcmp(argv[2], "procconn") == 0);
+    int use_seize = (argc >= 3) && (strcmp(argv[2], "seize") == 0);
+
+    // use the config shared by the launcher if available, see sharedpolicy.c
+    if ((argc == 4) && (atoi(argv[3]) >= 0)) {
+        if (config_attach(atoi(argv[3])) == 0) LOGD("Using shared config");
+    }
 
 #ifndef DEBUG
     // make ourselves less obvious in ps output
     prettify(argc, argv, strstr(LOG_TAG, "64") == 0 ? "zygote64" : "zygote");
 #endif
 
-    // attach to target and monitor its forks and clones
-    if (trace(PTRACE_ATTACH, target, NULL, 0) != -1) {
-        LOGD("Attached to [%d]", target);
-        wait_stop(target);
-
-        trace(PTRACE_SETOPTIONS, target, NULL,
-            PTRACE_O_TRACECLONE |
-//            PTRACE_O_TRACEEXEC | #do not want
-            PTRACE_O_TRACEEXIT |
-            PTRACE_O_TRACEFORK |
-//            PTRACE_O_TRACESYSGOOD | #do not want
-            PTRACE_O_TRACEVFORK // |
-//            PTRACE_O_TRACEVFORKDONE | #do not want
-//            PTRACE_O_TRACESECCOMP | #do not want
-//            PTRACE_O_SUSPEND_SECCOMP #do not want and does not exist in headers
-        );
-
-#define PID_MAX 32768
-        int first_stop[PID_MAX] = {0};
-        int forked[PID_MAX] = {0};
-        int parent[PID_MAX] = {0};
+    stats_open(STATS_PATH);
+    eventlog_open(EVENTS_PATH);
+
+    if (use_procconn) {
+        return procconn_main();
+    }
+
+    // before starting any threads, see wait_stop()
+    trace_init();
+
+    // unmount on pre-spawned workers rather than forking per app, falls back to forking
+    nsworker_start(NSWORKER_COUNT);
+
+    // started after the workers so the watcher thread inherits their signal mask
+    watch_config();
+
+    // attach to the zygotes and monitor their forks and clones
+    if (attach_all(use_seize) == 0) {
+        pid_t targets[MAX_ZYGOTES];
+        for (int i = 0; i < zygote_count; i++) targets[i] = zygotes[i].pid;
+        record_open(RECORD_PATH, targets, zygote_count, seized ? RECORD_SEIZED : 0);
 
         int status;
-        trace(PTRACE_CONT, target, NULL, 0);
         while (1) {
+            struct nsworker_result completed;
+            while (nsworker_collect(&completed)) {
+                record_collect(completed.pid, completed.cookie, completed.result.unmounted, completed.result.failed, completed.result.skipped);
+                LOGD("[%d] unmount done: %d unmounted, %d failed, %d skipped", completed.pid, completed.result.unmounted, completed.result.failed, completed.result.skipped);
+                record_unmount(completed.pid, &completed.result);
+                struct tracee* app = pidtable_get(completed.pid);
+                if ((app != NULL) && (app->generation == completed.cookie) && app->unmounting) {
+                    stats_record(STATS_QUEUE, app->detected_at, completed.result.started);
+                    stats_record(STATS_DETACH, completed.result.finished, monotonic_ns());
+                    finish_package(app->resume, completed.pid);
+                }
+            }
+
+            expire_early();
+
             int detached = 0;
-            int pid = waitpid(-1, &status, __WALL);
+            int pid = nsworker_waitpid(-1, &status, __WALL);
             int signal = 0;
             if (pid > 0) {
                 LOGD("[%d] waitpid", pid);
+                record_wait(pid, status);
+                struct tracee* job = pidtable_get(pid);
+                if ((job != NULL) && job->helper) {
+                    // unmount helper, not traced
+                    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+                        LOGD("[%d] unmount done [%d]", job->leader, pid);
+                        eventlog_write(EVENTLOG_UNMOUNT_DONE, job->leader, 0, 0, 0, -1);
+                        pid_t leader = pidtable_leader(job); // app may have died meanwhile
+                        pidtable_remove(pid);
+                        if (leader != 0) {
+                            finish_package(pidtable_get(leader)->resume, leader);
+                        }
+                    }
+                    continue;
+                }
+
                 if (WIFSTOPPED(status)) {
                     LOGD("[%d] stopped", pid);
-                    if (WSTOPSIG(status) == SIGTRAP) {
+                    eventlog_write(EVENTLOG_STOP, pid, WEVENT(status), 0, 0, WSTOPSIG(status));
+                    struct tracee* stopped = pidtable_get(pid);
+                    if ((stopped != NULL) && stopped->forked && !stopped->fork_traced && !stopped->first_stop) {
+                        // thread of a secondary zygote that existed before it was detected
+                        struct tracee* server = pidtable_get(pidtable_leader(stopped));
+                        if ((server != NULL) && server->secondary && (trace(PTRACE_SETOPTIONS, pid, NULL, TRACE_OPTIONS) == 0)) {
+                            stopped->fork_traced = 1;
+                        }
+                    }
+                    if (seized && (WEVENT(status) == PTRACE_EVENT_STOP)) {
+                        struct tracee* tracee = pidtable_get(pid);
+                        if (WSTOPSIG(status) != SIGTRAP) {
+                            // group-stop, leave it stopped until SIGCONT without resuming it
+                            trace(PTRACE_LISTEN, pid, NULL, 0);
+                            signal = -1;
+                        } else if ((tracee != NULL) && tracee->first_stop) {
+                            // new fork or clone starts with PTRACE_EVENT_STOP
+                            signal = first_stop(pid, tracee);
+                            LOGD("[%d] stopped (first, seized)", pid);
+                        }
+                        // otherwise this is a PTRACE_INTERRUPT stop that outlived detach_seized(),
+                        // just continue
+                    } else if (WSTOPSIG(status) == SIGTRAP) {
                         if (WEVENT(status) != 0) { // not sure yet why those happen
                             // see https://lwn.net/Articles/446593/ for some of this handling
 #ifdef DEBUG
@@ -254,54 +752,104 @@ int main(int argc, char *argv[], char** envp) {
                                 case PTRACE_EVENT_EXIT: event = "EXIT"; break;
                             }
 #endif
-                            int childpid = -1;
-                            trace(PTRACE_GETEVENTMSG, pid, 0, (size_t)&childpid);
+                            unsigned long msg = 0; // the kernel writes a long
+                            trace(PTRACE_GETEVENTMSG, pid, 0, (size_t)&msg);
+                            record_eventmsg(pid, msg);
+                            int childpid = (int)msg;
                             LOGD("[%d] trapped: [%s][%d] [%d]", pid, event, WEVENT(status), childpid);
 
                             if ((WEVENT(status) == PTRACE_EVENT_FORK) || (WEVENT(status) == PTRACE_EVENT_VFORK) || (WEVENT(status) == PTRACE_EVENT_CLONE)) {
-                                if ((pid == target) && (WEVENT(status) != PTRACE_EVENT_CLONE)) { // fork of target
-                                    forked[childpid] = 1;
-                                    parent[childpid] = childpid;
-                                } else if (forked[pid] && (WEVENT(status) == PTRACE_EVENT_CLONE)) { // clone of fork
-                                    forked[childpid] = 1;
-                                    int p = pid;
-                                    while ((p != 0) && (parent[p] != p)) p = parent[p];
-                                    parent[childpid] = p;
-
-                                    if (detect_package_and_unmount(p, target)) {
+                                struct tracee* parent = pidtable_get(pid);
+                                pid_t p = pidtable_leader(parent);
+                                int zygote = zygote_index(pid);
+                                int parent_forked = (parent != NULL) && parent->forked;
+                                struct tracee* server = (p != 0) ? pidtable_get(p) : NULL;
+                                int parent_secondary = (server != NULL) && server->secondary;
+                                int server_zygote = parent_secondary ? server->zygote : 0;
+                                uint32_t inherited = parent_secondary ? server->inherited : 0;
+                                struct tracee* existing = pidtable_get(childpid);
+                                int early = (existing != NULL) && existing->early;
+                                // pidtable_add() may grow the table, parent is invalid past this point
+                                struct tracee* child = pidtable_add(childpid);
+                                if (child == NULL) {
+                                    // out of memory, let it run untracked rather than mishandle its stops
+                                } else if ((zygote >= 0) && (WEVENT(status) != PTRACE_EVENT_CLONE)) { // fork of a zygote
+                                    eventlog_write(EVENTLOG_FORK, childpid, 0, 0, 0, pid);
+                                    add_fork(childpid, child, zygote, 0, 0);
+                                    child->first_stop = 1;
+                                } else if (parent_secondary && (WEVENT(status) != PTRACE_EVENT_CLONE)) { // fork of a secondary zygote
+                                    eventlog_write(EVENTLOG_FORK, childpid, 0, 0, 0, p);
+                                    add_fork(childpid, child, server_zygote, p, inherited);
+                                    child->first_stop = 1;
+                                } else if (parent_forked && (p != 0) && (WEVENT(status) == PTRACE_EVENT_CLONE)) { // clone of fork
+                                    stats_add(STATS_CLONES, 1);
+                                    eventlog_write(EVENTLOG_CLONE, childpid, 0, 0, 0, p);
+                                    child->forked = 1;
+                                    pidtable_join(child, p);
+                                    child->first_stop = 1;
+
+                                    int hide;
+                                    char cmdline[128];
+                                    if (parent_secondary) {
+                                        // thread of a secondary zygote, already detected
+                                    } else if (detect_package_and_policy(&pidtable_get(p)->proc, pidtable_get(p)->inherited, cmdline, &hide)) {
                                         LOGD("[%d] package detected [%d]", pid, childpid);
+                                        struct tracee* app = pidtable_get(p);
+                                        app->detected_at = monotonic_ns();
+                                        stats_add(STATS_DETECTED, 1);
+                                        if (hide) stats_add(STATS_HIDDEN, 1);
+                                        eventlog_write(EVENTLOG_DETECT, p, 0, hide, 0, 0);
+                                        stats_record(STATS_DETECT, app->forked_at, app->detected_at);
                                         signal = -1;
-                                        if (trace(PTRACE_CONT, pid, NULL, 0) != ESRCH) {
-                                            detach_pid(p);
+                                        if (is_secondary_zygote(cmdline)) promote_secondary(pid, p, cmdline);
+                                        // if unmounting, keep pid stopped and go back to servicing other
+                                        // events, we finish up when the job completes
+                                        if (!hide || (start_unmount(pid, p) != 0)) {
+                                            finish_package(pid, p);
                                         }
                                     } else {
                                         LOGD("[%d] package NOT detected [%d]", pid, childpid);
                                     }
                                 } else {
-                                    forked[childpid] = 0;
-                                    parent[childpid] = 0;
+                                    child->first_stop = 1;
+                                }
+                                // its first stop was reported before this event. Look it up again,
+                                // detection may have grown the table or detached it already
+                                child = early ? pidtable_get(childpid) : NULL;
+                                if ((child != NULL) && child->first_stop) {
+                                    int child_signal = first_stop(childpid, child);
+                                    LOGD("[%d] stopped (first, early): %d", childpid, child_signal);
+                                    if (child_signal >= 0) {
+                                        trace(PTRACE_CONT, childpid, NULL, child_signal);
+                                    }
                                 }
-                                first_stop[childpid] = 1;
                             } else if (WEVENT(status) == PTRACE_EVENT_EXIT) {
                                 // use pid here, not childpid !
-                                if (pid == target)
+                                if (zygote_index(pid) >= 0)
                                     break;
                                 trace(PTRACE_CONT, pid, NULL, 0);
                                 detached = 1;
                             }
                         }
                     } else {
-                        if (first_stop[pid]) {
+                        struct tracee* tracee = pidtable_get(pid);
+                        if ((tracee != NULL) && tracee->first_stop) {
                             // new fork or clone starts with a STOP signal
-
-                            first_stop[pid] = 0;
-                            if (forked[pid]) {
-                                // we don't want forks of our forks to be traced, but we do want clones (threads)
-                                trace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACECLONE);
-                            }
-
+                            signal = first_stop(pid, tracee);
                             LOGD("[%d] stopped (first): %d [%08x]", pid, WSTOPSIG(status), status);
-                        } else if (WSTOPSIG(status) != SIGSTOP) { // we cause SIGSTOP, ignore and drop
+                        } else if ((tracee == NULL) && (WSTOPSIG(status) == SIGSTOP) && !seized && may_be_early(pid)) {
+                            // new fork or clone whose parent's event has not been reported yet.
+                            // Keep it stopped so it cannot start threads we would not recognize,
+                            // its first stop is handled along with that event
+                            struct tracee* early = pidtable_add(pid);
+                            if (early != NULL) {
+                                early->early = 1;
+                                early->forked_at = monotonic_ns();
+                                if (early_expires == 0) early_expires = early->forked_at + EARLY_TIMEOUT_MS * 1000000ULL;
+                                signal = -1;
+                            }
+                            LOGD("[%d] stopped (early)", pid);
+                        } else if (seized || (WSTOPSIG(status) != SIGSTOP)) { // unless seized we cause SIGSTOP, ignore and drop
                             pid_t from = -1;
                             (void)from; // unused variable error
                             siginfo_t siginfo;
@@ -315,12 +863,14 @@ int main(int argc, char *argv[], char** envp) {
                     }
                 } else if (WIFSIGNALED(status)) {
                     LOGD("[%d] signaled: %d", pid, WTERMSIG(status));
-                    if (pid == target)
+                    eventlog_write(EVENTLOG_EXIT, pid, 0, 0, 0, status);
+                    if (zygote_index(pid) >= 0)
                         break;
                     detached = 1;
                 } else if (status == 0) {
                     LOGD("[%d] died: %d", pid, status);
-                    if (pid == target)
+                    eventlog_write(EVENTLOG_EXIT, pid, 0, 0, 0, status);
+                    if (zygote_index(pid) >= 0)
                         break;
                     detached = 1;
                 } else {
@@ -331,19 +881,19 @@ int main(int argc, char *argv[], char** envp) {
                         trace(PTRACE_CONT, pid, NULL, signal);
                     }
                 } else {
-                    first_stop[pid] = 0;
-                    forked[pid] = 0;
-                    parent[pid] = 0;
+                    remove_tracee(pid);
                 }
             }
+            stats_set(STATS_TRACED, pidtable_count());
         }
 
-        // detach
-        trace(PTRACE_DETACH, target, NULL, 0);
-        kill(target, SIGCONT);
-        LOGD("Detached from [%d]", target);
+        // detach, one zygote died so we start over with all of them
+        for (int i = 0; i < zygote_count; i++) {
+            trace(PTRACE_DETACH, zygotes[i].pid, NULL, 0);
+            if (!seized) proc_handle_kill(&zygotes[i], SIGCONT);
+            LOGD("Detached from [%d]", zygotes[i].pid);
+        }
     } else {
-        LOGD("Attach failed [%d]", errno);
         return 1;
     }
 
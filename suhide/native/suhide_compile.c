@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* suhide_compile compiles the text suhide.uid into the binary policy that suhide[32|64] map
+ * (see policy.h). It depends on nothing Android-specific, on a Linux host it can be built with
+ * the same flags as in Android.mk:
+ *
+ *     cc -std=c11 -O2 -o suhide_compile policy.c suhide_compile.c
+ *
+ * The output is written next to the source with a .bin extension unless specified, and
+ * replaced atomically.
+ */
+
+// O_CLOEXEC and PATH_MAX are not part of strict C11, glibc only declares them with this
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "policy.h"
+
+#define UIDFILE "/sbin/supersu/suhide/suhide.uid"
+
+// generation of the existing output, 0 if there is none
+static uint32_t previous_generation(const char* path) {
+    struct policy header;
+    uint32_t generation = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if ((read(fd, &header, sizeof(header)) == sizeof(header)) && (header.magic == POLICY_MAGIC)) {
+            generation = header.generation;
+        }
+        close(fd);
+    }
+    return generation;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 3) {
+        fprintf(stderr, "Usage: %s [<source> [<output>]]\n", argv[0]);
+        return 1;
+    }
+    const char* source = argc > 1 ? argv[1] : UIDFILE;
+    char output[PATH_MAX];
+    char temp[PATH_MAX + 8];
+    if (argc > 2) {
+        snprintf(output, PATH_MAX, "%s", argv[2]);
+    } else {
+        snprintf(output, PATH_MAX, "%s.bin", source);
+    }
+    snprintf(temp, sizeof(temp), "%s.tmp", output);
+
+    int fd = open(source, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "%s: cannot open\n", source);
+        return 1;
+    }
+
+    // stat before reading, if the source changes while we read, the stamp will not match
+    // and the tracers fall back to the text
+    struct stat stat;
+    if (fstat(fd, &stat) != 0) {
+        close(fd);
+        return 1;
+    }
+    size_t size = (size_t)stat.st_size;
+    char* text = (char*)malloc(size + 1);
+    size_t len = 0;
+    while ((text != NULL) && (len < size)) {
+        ssize_t r = read(fd, &text[len], size - len);
+        if (r <= 0) break;
+        len += r;
+    }
+    close(fd);
+    if (text == NULL) return 1;
+
+    uint32_t generation = previous_generation(output) + 1;
+    if (generation == 0) generation = 1; // 0 means compiled in memory
+    struct policy* policy = policy_compile(text, len, generation);
+    free(text);
+    if (policy == NULL) {
+        fprintf(stderr, "%s: cannot compile\n", source);
+        return 1;
+    }
+    policy->source_size = (uint64_t)stat.st_size;
+    policy->source_mtime = (uint64_t)stat.st_mtim.tv_sec * 1000000000ULL + (uint64_t)stat.st_mtim.tv_nsec;
+
+    fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "%s: cannot create\n", temp);
+        free(policy);
+        return 1;
+    }
+    int ok = (write(fd, policy, policy->size) == (ssize_t)policy->size) && (fsync(fd) == 0);
+    ok = (close(fd) == 0) && ok;
+    if (ok && (rename(temp, output) != 0)) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "%s: cannot write\n", output);
+        unlink(temp);
+    } else {
+        printf("%s: generation %u, %u uids, %u processes, %u bytes\n", output, generation, policy->uid_count, policy->name_count, policy->size);
+    }
+    free(policy);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* suhide_events decodes the event log of a running or stopped suhide[32|64] (see
+ * eventlog.h). It depends on nothing Android-specific, on a Linux host it can be built with:
+ *
+ *     cc -std=gnu11 -O2 -o suhide_events suhide_events.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "eventlog.h"
+
+static const char* names[EVENTLOG_TYPES] = {
+    "?", "ATTACH", "STOP", "FORK", "CLONE", "DETECT", "UNMOUNT_START", "UNMOUNT_FAIL",
+    "UNMOUNT_DONE", "DETACH", "EXIT", "TRACE_ERROR", "SECONDARY"
+};
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <events file>, usually /sbin/supersu/suhide/suhide32.events or /sbin/supersu/suhide/suhide64.events\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: cannot open\n", argv[1]);
+        return 1;
+    }
+    void* data = mmap(NULL, sizeof(struct eventlog), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "%s: cannot map\n", argv[1]);
+        return 1;
+    }
+    const struct eventlog* ring = (const struct eventlog*)data;
+    if ((ring->magic != EVENTLOG_MAGIC) || (ring->version != EVENTLOG_VERSION) || (ring->capacity != EVENTLOG_CAPACITY)) {
+        fprintf(stderr, "%s: not an event log\n", argv[1]);
+        return 1;
+    }
+
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t first = head > EVENTLOG_CAPACITY ? head - EVENTLOG_CAPACITY : 0;
+    printf("pid %u, %u records written, %u retained\n", ring->pid, head, head - first);
+    printf("%14s %7s %-14s %5s %3s %5s %8s\n", "time(ms)", "pid", "type", "event", "dec", "errno", "arg");
+
+    uint64_t start = 0;
+    uint32_t torn = 0;
+    for (uint32_t i = first; i != head; i++) {
+        const struct eventlog_record* slot = &ring->records[i & (EVENTLOG_CAPACITY - 1)];
+        struct eventlog_record record;
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        memcpy(&record, slot, sizeof(record));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((seq != i + 1) || (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)) {
+            // being written, or overwritten since we read head
+            torn++;
+            continue;
+        }
+
+        if (start == 0) start = record.time;
+        printf("%14.3f %7d %-14s %5d %3d %5d %8d\n",
+            (double)(record.time - start) / 1000000.0, record.pid,
+            record.type < EVENTLOG_TYPES ? names[record.type] : "?",
+            record.event, record.decision, record.err, record.arg);
+    }
+    if (torn > 0) printf("%u records skipped while being written\n", torn);
+    return 0;
+}
@@ -14,14 +14,20 @@
  * limitations under the License.
  */
 
-/* Main file for suhide (launcher), which launches suhide[32|64] children that
- * attach to zygote(64) as debugger to hide root. Additionally, it monitors
- * hardware button input and (un)hides packages.
+/* Main file for suhide (launcher), which launches a single suhide[32|64] child that
+ * attaches to all zygotes as debugger to hide root (the 64-bit version if available, it
+ * can trace 32-bit processes too). Additionally, it monitors hardware button input and
+ * (un)hides packages.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <sys/wait.h>
 #include <dirent.h>
 #include <linux/input.h>
@@ -29,16 +35,51 @@
 #include "ndklog.h"
 #include "util.h"
 #include "getevent.h"
+#include "config.h"
+#include "procconn.h"
 
-// pids for currently running versions of suhide and zygote
-pid_t suhide32 = 0;
-pid_t suhide64 = 0;
-pid_t zygote32 = 0;
-pid_t zygote64 = 0;
+// pid of the currently running suhide child
+pid_t tracer = 0;
+
+// zygotes to trace, and their pids once found. zygote64 is only waited for if we have
+// 64-bit versions
+#define ZYGOTE_COUNT 2
+char* zygote_names[ZYGOTE_COUNT] = { "zygote", "zygote64" };
+pid_t zygotes[ZYGOTE_COUNT] = { 0, 0 };
 
 // do we have 64-bit versions?
 int have64 = 0;
 
+// fork detection backend passed to suhide children, see suhide.c
+char* backend = "ptrace";
+
+// fd of the config segment shared with suhide children, see sharedpolicy.c
+int policy_fd = -1;
+
+// signal mask to restore in children, SIGCHLD is blocked for the signalfd
+sigset_t child_sigmask;
+
+// number of times the suhide child was restarted, and monotonic_ns() when it was last seen
+// to have stopped
+int restarts = 0;
+uint64_t stopped_at = 0;
+
+// a suhide child that stops within RESTART_FAST_MS of its launch is restarted right away the
+// first time, and after RESTART_BACKOFF_MS, doubling up to RESTART_BACKOFF_MAX_MS, when it
+// keeps doing so, rather than being fork/exec'd in a loop
+#define RESTART_FAST_MS 2000
+#define RESTART_BACKOFF_MS 250
+#define RESTART_BACKOFF_MAX_MS 60000
+
+// monotonic_ns() when the suhide child was last launched, the number of fast stops in a row,
+// and monotonic_ns() before which it is not launched again
+uint64_t launched_at = 0;
+int fast_stops = 0;
+uint64_t restart_at = 0;
+
+// last 6 input_events
+struct input_event events[6];
+
 // get path to executable, self must be PATH_MAX in size, returns 0 on success
 static int get_self(char* self) {
     int len = readlink("/proc/self/exe", self, PATH_MAX);
@@ -58,57 +99,141 @@ static int get_suhide(char* bits, char* self, char* suhide) {
     return 0;
 }
 
+// is pid an app_process named name ? returns 1 if so
+static int is_process(pid_t pid, char* name) {
+    char buf[PATH_MAX], path[PATH_MAX];
+    int ret = 0;
+    memset(path, 0, 64);
+    snprintf(path, 64, "/proc/%d/exe", pid);
+    int len = readlink(path, buf, PATH_MAX);
+    if ((len >= 0) && (len < PATH_MAX)) {
+        buf[len] = '\0';
+        if (strstr(buf, "app_process") != NULL) {
+            memset(path, 0, 64);
+            snprintf(path, 64, "/proc/%d/cmdline", pid);
+            int fd = open(path, O_RDONLY);
+            if (fd >= 0) {
+                if (read(fd, buf, PATH_MAX) > strlen(name)) {
+                    if ((strncmp(buf, name, strlen(name)) == 0) && ((buf[strlen(name)] == '\0') || (buf[strlen(name)] == ' '))) {
+                        ret = 1;
+                    }
+                }
+                close(fd);
+            }
+        }
+    }
+    return ret;
+}
+
 // find pid for process, returns 0 on error
 static pid_t find_process(char* name) {
-    char buf[PATH_MAX], path[PATH_MAX];
     pid_t ret = 0;
     DIR* dir;
     struct dirent *ent;
     if ((dir = opendir("/proc/")) != NULL) {
         while ((ent = readdir(dir)) != NULL) {
             pid_t pid = atoi(ent->d_name);
-            if (pid > 0) {
-                memset(path, 0, 64);
-                snprintf(path, 64, "/proc/%d/exe", pid);
-                int len = readlink(path, buf, PATH_MAX);
-                if ((len >= 0) && (len < PATH_MAX)) {
-                    buf[len] = '\0';
-                    if (strstr(buf, "app_process") != NULL) {
-                        memset(path, 0, 64);
-                        snprintf(path, 64, "/proc/%d/cmdline", pid);
-                        int fd = open(path, O_RDONLY);
-                        if (fd >= 0) {
-                            if (read(fd, buf, PATH_MAX) > strlen(name)) {
-                                if ((strncmp(buf, name, strlen(name)) == 0) && ((buf[strlen(name)] == '\0') || (buf[strlen(name)] == ' '))) {
-                                    ret = pid;
-                                }
-                            }
-                            close(fd);
-                        }
-                    }
-                }
+            if ((pid > 0) && is_process(pid, name)) {
+                ret = pid;
+                break;
             }
-            if (ret > 0) break;
         }
         closedir(dir);
     }
     return ret;
 }
 
-// launch child suhide process with zygote parameter, returns new pid
-static pid_t launch_child(char* path, pid_t zygote) {
+// how long to wait for a zygote's comm event before scanning /proc anyway, in case it was
+// renamed without one
+#define FIND_RESCAN_MS 2000
+
+// find the first wanted zygotes that are not known yet, waiting for them to start if needed.
+// Rather than scanning /proc repeatedly, we subscribe to proc connector comm events: zygote
+// renames itself from app_process right after exec (see app_main.cpp), and only processes
+// whose new name matches are checked. The subscription is made before the initial scan so a
+// zygote starting in between is not missed, and dropped once all are found. Without the proc
+// connector we poll instead
+static void find_zygotes(int wanted) {
+    int known = 0;
+    for (int i = 0; i < wanted; i++) {
+        if (zygotes[i] != 0) known++;
+    }
+    if (known == wanted) return;
+
+    int fd = procconn_open();
+    if (fd >= 0) {
+        const unsigned int whats[] = { PROC_EVENT_COMM };
+        procconn_filter(fd, whats, 1);
+    }
+
+    int scan = 1;
+    while (1) {
+        int missing = 0;
+        for (int i = 0; i < wanted; i++) {
+            if ((zygotes[i] == 0) && scan) {
+                zygotes[i] = find_process(zygote_names[i]);
+                if (zygotes[i] != 0) fprintf(stderr, "%s: %d\n", zygote_names[i], zygotes[i]);
+            }
+            if (zygotes[i] == 0) missing++;
+        }
+        if (missing == 0) break;
+        scan = 0;
+
+        if (fd < 0) {
+            ms_sleep(128);
+            scan = 1;
+            continue;
+        }
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, FIND_RESCAN_MS) <= 0) {
+            scan = 1;
+            continue;
+        }
+        struct procconn_event event;
+        int r = procconn_read(fd, &event);
+        if (r < 0) {
+            // connector broke, fall back to polling
+            close(fd);
+            fd = -1;
+            scan = 1;
+        } else if (r == 2) {
+            // events were dropped, we may have missed the rename
+            scan = 1;
+        } else if ((r == 1) && (event.what == PROC_EVENT_COMM)) {
+            for (int i = 0; i < wanted; i++) {
+                if ((zygotes[i] == 0) && (strcmp(event.comm, zygote_names[i]) == 0) && is_process(event.tgid, zygote_names[i])) {
+                    zygotes[i] = event.tgid;
+                    fprintf(stderr, "%s: %d\n", zygote_names[i], zygotes[i]);
+                }
+            }
+        }
+    }
+
+    if (fd >= 0) close(fd);
+}
+
+// launch child suhide process with the found zygotes as parameter, returns new pid
+static pid_t launch_child(char* path) {
     if (strlen(path) == 0) return 0;
-    if (zygote == 0) return 0;
+
+    char param[PATH_MAX];
+    int len = 0;
+    for (int i = 0; i < ZYGOTE_COUNT; i++) {
+        if (zygotes[i] != 0) len += snprintf(&param[len], PATH_MAX - len, len == 0 ? "%d" : ",%d", zygotes[i]);
+    }
+    if (len == 0) return 0;
 
 #ifdef DEBUG
-    fprintf(stderr, "launching: %s\n", path);
+    fprintf(stderr, "launching: %s %s\n", path, param);
 #endif
 
     pid_t child = fork();
     if (child == 0) {
-        char param[PATH_MAX];
-        snprintf(param, PATH_MAX, "%d", zygote);
-        execl(path, path, param, (char*)NULL);
+        sigprocmask(SIG_SETMASK, &child_sigmask, NULL);
+        char policy[16];
+        snprintf(policy, sizeof(policy), "%d", policy_fd);
+        execl(path, path, param, backend, policy, (char*)NULL);
         exit(EXIT_FAILURE);
     }
 
@@ -136,14 +261,113 @@ static void stop_android() {
 static void switch_packages() {
     pid_t child = fork();
     if (child == 0) {
+        sigprocmask(SIG_SETMASK, &child_sigmask, NULL);
         execl("/sbin/supersu/suhide/switch_packages", "switch_packages", (char*)NULL);
         exit(EXIT_FAILURE);
     }
 }
 
+// open a signalfd for SIGCHLD, which is blocked from here on so it is only delivered through
+// the fd. Returns the fd or -1 on error, in which case SIGCHLD is left alone
+static int open_sigchld() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &set, &child_sigmask) != 0) return -1;
+    int fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) sigprocmask(SIG_SETMASK, &child_sigmask, NULL);
+    return fd;
+}
+
+// reap exited children, returns 1 if the suhide child was among them
+static int reap_children(int sigchld_fd) {
+    struct signalfd_siginfo info;
+    if (sigchld_fd >= 0) {
+        while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info));
+    }
+
+    int ret = 0;
+    int status;
+    pid_t waited;
+    while ((waited = waitpid(0, &status, WNOHANG)) > 0) {
+        if ((waited == tracer) && (WIFEXITED(status) || WIFSIGNALED(status))) ret = 1;
+    }
+    return ret;
+}
+
+// note that the suhide child stopped, and decide when to launch it again
+static void backoff_restart() {
+    uint64_t now = monotonic_ns();
+    fast_stops = (now - launched_at < RESTART_FAST_MS * 1000000ULL) ? fast_stops + 1 : 0;
+    uint64_t delay_ms = 0;
+    if (fast_stops > 1) {
+        int shift = fast_stops - 2;
+        delay_ms = (shift < 8) ? (uint64_t)RESTART_BACKOFF_MS << shift : RESTART_BACKOFF_MAX_MS;
+        if (delay_ms > RESTART_BACKOFF_MAX_MS) delay_ms = RESTART_BACKOFF_MAX_MS;
+    }
+    restart_at = now + delay_ms * 1000000ULL;
+    if (delay_ms > 0) fprintf(stderr, "suhide stopped %d times in a row, restarting in %d ms\n", fast_stops, (int)delay_ms);
+}
+
+// forget the zygotes that are gone (or whose pid was reused), so only those are looked up again
+static void drop_dead_zygotes() {
+    for (int i = 0; i < ZYGOTE_COUNT; i++) {
+        if ((zygotes[i] != 0) && !is_process(zygotes[i], zygote_names[i])) {
+            fprintf(stderr, "%s gone\n", zygote_names[i]);
+            zygotes[i] = 0;
+        }
+    }
+}
+
+// track key presses, and switch package visibility on the volume key sequence
+static void handle_event(struct input_event* event) {
+    if (
+            (event->type == EV_KEY) &&
+            (event->value == 1) // down
+    ) {
+        int i;
+        for (i = 0; i < 5; i++) {
+            events[i] = events[i + 1];
+        }
+        events[5] = *event;
+
+        // UP, DOWN, UP, DOWN, UP DOWN, 3 seconds (only volume keys are read, see getevent.c)
+        if (
+            (events[0].code == KEY_VOLUMEUP) &&
+            (events[1].code == KEY_VOLUMEDOWN) &&
+            (events[2].code == KEY_VOLUMEUP) &&
+            (events[3].code == KEY_VOLUMEDOWN) &&
+            (events[4].code == KEY_VOLUMEUP) &&
+            (events[5].code == KEY_VOLUMEDOWN)
+        ) {
+            struct timeval diff;
+            timersub(&events[3].time, &events[0].time, &diff);
+            if ((int)diff.tv_sec < 3) {
+                memset(&events[0], 0, sizeof(events[0]) * 6);
+                fprintf(stderr, "Switching package visibility...\n");
+                switch_packages();
+            }
+        }
+    }
+}
+
 int main(int argc, char *argv[], char** envp) {
-    // start with --nodaemon for debugging purposes
-    if (!((argc >= 2) && (strcmp(argv[1], "--nodaemon") == 0))) {
+    // start with --nodaemon for debugging purposes, --procconn to follow zygote using the
+    // proc connector instead of ptrace, --seize to trace using PTRACE_SEIZE (Linux 3.4+).
+    // --procconn never stops zygote, but hides less reliably: an app only learns of its uid or
+    // name change after the fact, so it runs with root mounts present until it is stopped, and
+    // an app that checks its mounts right away can see them, more so when many apps start
+    int nodaemon = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--nodaemon") == 0) {
+            nodaemon = 1;
+        } else if (strcmp(argv[i], "--procconn") == 0) {
+            backend = "procconn";
+        } else if (strcmp(argv[i], "--seize") == 0) {
+            backend = "seize";
+        }
+    }
+    if (!nodaemon) {
         fork_daemon(0);
     }
 
@@ -158,9 +382,29 @@ int main(int argc, char *argv[], char** envp) {
     get_suhide("32", path_self, path_suhide32);
     have64 = get_suhide("64", path_self, path_suhide64) == 0 ? 1 : 0;
 
-    // last 6 input_events
-    struct input_event events[6];
+    // wake up as soon as the suhide child exits. SIGCHLD is blocked before config_share()
+    // starts the config watcher, so that thread inherits the mask and cannot swallow it
+    sigemptyset(&child_sigmask);
+    int sigchld_fd = open_sigchld();
+
+    // load the config once for all suhide children, they load it themselves if this fails
+    policy_fd = config_share();
+
+    // a single epoll set for input devices, their hotplug watch, and the suhide child's exit
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) return 1;
+
+    if (sigchld_fd >= 0) {
+        struct epoll_event watch;
+        memset(&watch, 0, sizeof(watch));
+        watch.events = EPOLLIN;
+        watch.data.fd = sigchld_fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, sigchld_fd, &watch);
+    }
+
+    // input devices are added and removed as they come and go, so this is done once
     memset(&events[0], 0, sizeof(events[0]) * 6);
+    open_getevent(epfd);
 
     // never quit
     while (1) {
@@ -169,107 +413,73 @@ int main(int argc, char *argv[], char** envp) {
 #endif
 
         // find 32 and 64-bit zygote processes, waiting for them to start if not yet running
-        while ((zygote32 == 0) || ((zygote64 == 0) && (have64 == 1))) {
-            int found = 0;
-            if (zygote32 == 0) {
-                zygote32 = find_process("zygote");
-                if (zygote32 != 0) {
-                    fprintf(stderr, "zygote32: %d\n", zygote32);
-                    found = 1;
-                }
-            } else if ((zygote64 == 0) && (have64 == 1)) {
-                zygote64 = find_process("zygote64");
-                if (zygote64 != 0) {
-                    fprintf(stderr, "zygote64: %d\n", zygote64);
-                    found = 1;
-                }
+        find_zygotes(have64 ? 2 : 1);
+
+        // launch suhide process if not yet running, one for all zygotes, unless backing off
+        int delayed = (tracer == 0) && (monotonic_ns() < restart_at);
+        if ((tracer == 0) && !delayed) {
+            tracer = launch_child(have64 ? path_suhide64 : path_suhide32);
+            launched_at = monotonic_ns();
+            if ((tracer > 0) && (stopped_at != 0)) {
+                fprintf(stderr, "suhide restarted (%d) %.1f us after it stopped\n", restarts, (monotonic_ns() - stopped_at) / 1000.0);
+                stopped_at = 0;
             }
-
-            if (!found)
-                ms_sleep(128);
         }
 
-        // launch suhide processes if not yet running
-        if (suhide32 == 0) suhide32 = launch_child(path_suhide32, zygote32);
-        if (suhide64 == 0) suhide64 = launch_child(path_suhide64, zygote64);
-
-        // (re-)initialize input event monitoring
-        reset_getevent();
-
-        // loop until one of our suhide children exits
-        while (1) {
+        // handle input until our suhide child exits. Without the signalfd, we check for that
+        // once per second instead
+        int stopped = 0;
+        while (!stopped) {
 #ifdef DEBUG
             fprintf(stderr, "inner loop\n");
 #endif
 
-            // input detection loop, waits one second for input and keeps looping until
-            // there hasn't been any input for again one second
-            struct input_event event;
-            int event_count = 0;
-            while ((event_count = get_event(&event, 1000)) > 0) {
-#ifdef DEBUG
-                fprintf(stderr, "event loop\n");
-#endif
+            int timeout = sigchld_fd >= 0 ? -1 : 1000;
+            if (delayed) {
+                // keep handling input until the restart is due
+                uint64_t now = monotonic_ns();
+                if (now >= restart_at) break;
+                timeout = (int)((restart_at - now + 999999) / 1000000);
+            }
 
-                if (
-                        (event.type == EV_KEY) &&
-                        (event.value == 1) // down
-                ) {
-                    int i;
-                    for (i = 0; i < 5; i++) {
-                        events[i] = events[i + 1];
-                    }
-                    events[5] = event;
-
-                    // UP, DOWN, UP, DOWN, UP DOWN, 3 seconds, no other keys
-                    if (
-                        (events[0].code == KEY_VOLUMEUP) &&
-                        (events[1].code == KEY_VOLUMEDOWN) &&
-                        (events[2].code == KEY_VOLUMEUP) &&
-                        (events[3].code == KEY_VOLUMEDOWN) &&
-                        (events[4].code == KEY_VOLUMEUP) &&
-                        (events[5].code == KEY_VOLUMEDOWN)
-                    ) {
-                        struct timeval diff;
-                        timersub(&events[3].time, &events[0].time, &diff);
-                        if ((int)diff.tv_sec < 3) {
-                            memset(&events[0], 0, sizeof(events[0]) * 6);
-                            fprintf(stderr, "Switching package visibility...\n");
-                            switch_packages();
-                        }
-                    }
+            struct epoll_event ready[8];
+            int count = epoll_wait(epfd, ready, 8, timeout);
+            if ((count < 0) && (errno != EINTR)) {
+                ms_sleep(1000);
+            }
+            int reap = sigchld_fd < 0;
+            // every ready fd gets a single batched read per wakeup, and epoll rotates its
+            // ready list, so a busy device cannot starve the others
+            for (int i = 0; i < count; i++) {
+                if (ready[i].data.fd == sigchld_fd) {
+                    reap = 1;
+                    continue;
+                }
+                struct input_event batch[64];
+                int read_count = read_getevent(ready[i].data.fd, batch, 64);
+                for (int j = 0; j < read_count; j++) {
+                    handle_event(&batch[j]);
                 }
             }
 
-            // error occurred, probably a device got added or removed, re-init
-            if (event_count < 0) break;
-
 #ifdef DEBUG
             fprintf(stderr, "waitpid\n");
 #endif
 
-            // check if our suhide children are still alive, break parent loop and re-init otherwise
-            int status;
-            pid_t waited = waitpid(0, &status, WNOHANG);
-            if ((waited > 0) && ((waited == suhide32) || (waited == suhide64))) {
-                if (WIFEXITED(status) || WIFSIGNALED(status)) {
-                    if (waited == suhide32) {
-                        stop_android();
-                        fprintf(stderr, "suhide32 stopped, restarting\n");
-                        suhide32 = 0;
-                        zygote32 = 0;
-                        break;
-                    } else if (waited == suhide64) {
-                        stop_android();
-                        fprintf(stderr, "suhide64 stopped, restarting\n");
-                        suhide64 = 0;
-                        zygote64 = 0;
-                        break;
-                    }
-                }
+            // check if our suhide child is still alive, break parent loop and re-init otherwise.
+            // It exits when any of the zygotes dies, so those are looked up again
+            if (reap && reap_children(sigchld_fd)) {
+                stopped_at = monotonic_ns();
+                restarts++;
+                stop_android();
+                fprintf(stderr, "suhide stopped, restarting\n");
+                backoff_restart();
+                tracer = 0;
+                drop_dead_zygotes();
+                stopped = 1;
             }
         }
     }
 
     return 0;
-}
\ No newline at end of file
+}
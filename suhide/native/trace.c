@@ -21,9 +21,19 @@
 #include <linux/ptrace.h>
 #include <sys/wait.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "ndklog.h"
 #include "util.h"
+#include "eventlog.h"
+
+// how long wait_stop() waits for a stop before giving up
+#define WAIT_STOP_TIMEOUT_MS 128
+
+// threads detach_seized() interrupts at once
+#define DETACH_BATCH 64
 
 // missing declaration
 int tgkill(int tgid, int tid, int sig);
@@ -33,6 +43,7 @@ long trace(int request, pid_t pid, void *addr, size_t data) {
     long ret = ptrace(request, pid, (caddr_t) addr, (void *) data);
     if (ret == -1) {
         LOGD("TRACE(%d, %d, %d, %d): %d", request, pid, (int)(uintptr_t)addr, (int)data, errno);
+        eventlog_write(EVENTLOG_TRACE_ERROR, pid, 0, 0, errno, request);
     }
     return ret;
 }
@@ -47,26 +58,49 @@ int stop(pid_t group, pid_t target) {
     return tgkill(group, target, SIGSTOP);
 }
 
-// wait for target to stop
+// block SIGCHLD so wait_stop() can sleep until it arrives. Must be called before any threads
+// are started so they inherit it, otherwise it may be delivered to (and dropped by) one of them
+void trace_init() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+// wait for target to stop, for at most WAIT_STOP_TIMEOUT_MS. We are sent SIGCHLD whenever a
+// tracee changes state, so between checks we sleep until it arrives rather than polling. A
+// SIGCHLD that arrives between the check and the sleep stays pending and ends the sleep right
+// away; one for a different tracee only causes another check
 void wait_stop(pid_t target) {
     LOGD("[%d] wait_stop(%d)", target, target);
-    struct timeval start = timestamp();
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    uint64_t deadline = monotonic_ns() + WAIT_STOP_TIMEOUT_MS * 1000000ULL;
     while (1) {
         int status;
         int pid = waitpid(target, &status, __WALL | WNOHANG);
         LOGD("[%d] waitpid --> %d/%d", target, pid, status);
         if ((pid == target) && WIFSTOPPED(status)) {
             break;
+        } else if ((pid == target) && (WIFEXITED(status) || WIFSIGNALED(status))) {
+            // exited before stopping and now reaped, no further SIGCHLD will come for it
+            LOGD("[%d] waitpid --> exited", target);
+            break;
         } else if (pid == -1) {
             // error
             LOGD("[%d] waitpid --> error", target);
             break;
         } else {
-            if (timestamp_diff_ms(timestamp(), start) > 128) {
+            uint64_t now = monotonic_ns();
+            if (now >= deadline) {
                 LOGD("[%d] waitpid --> timeout, zombie?", target);
                 break;
             }
-            ms_sleep(1);
+            struct timespec timeout;
+            timeout.tv_sec = (deadline - now) / 1000000000ULL;
+            timeout.tv_nsec = (deadline - now) % 1000000000ULL;
+            sigtimedwait(&set, NULL, &timeout);
         }
     }
     LOGD("[%d] /wait_stop(%d)", target, target);
@@ -110,17 +144,32 @@ int stop_and_detach(pid_t group, pid_t target) {
     return 1;
 }
 
-// stop and detach from each of pid's threads, then continue pid's execution
-void detach_pid(int pid) {
-    char task[PATH_MAX];
-    snprintf(task, PATH_MAX, "/proc/%d/task", pid);
+// open pid's task directory, procfd is pid's /proc directory, or -1 to look it up by path
+static DIR* open_tasks(int pid, int procfd) {
+    DIR* dir = NULL;
+    if (procfd >= 0) {
+        int taskfd = openat(procfd, "task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (taskfd >= 0) {
+            dir = fdopendir(taskfd);
+            if (dir == NULL) close(taskfd);
+        }
+    } else {
+        char task[PATH_MAX];
+        snprintf(task, PATH_MAX, "/proc/%d/task", pid);
+        dir = opendir(task);
+    }
+    return dir;
+}
 
+// stop and detach from each of pid's threads, then continue pid's execution. procfd is pid's
+// /proc directory, or -1 to look it up by path
+void detach_pid(int pid, int procfd) {
     LOGD("[%d] detaching", pid);
     stop_and_detach(pid, pid);
 
-    DIR* dir;
     struct dirent *ent;
-    if ((dir = opendir(task)) != NULL) {
+    DIR* dir = open_tasks(pid, procfd);
+    if (dir != NULL) {
         while ((ent = readdir(dir)) != NULL) {
             pid_t tid = atoi(ent->d_name);
             if ((tid > 0) && (tid != pid)) {
@@ -135,3 +184,47 @@ void detach_pid(int pid) {
 
     LOGD("[%d] detached", pid);
 }
+
+// detach from each of pid's threads, attached with PTRACE_SEIZE, without sending any signals.
+// Threads not already in a ptrace-stop are all interrupted first, then waited for, so their
+// stops overlap. Detaching resumes each thread; as no group-stop was caused, no SIGCONT is needed
+void detach_seized(int pid, int procfd) {
+    LOGD("[%d] detaching (seized)", pid);
+    pid_t tids[DETACH_BATCH];
+    unsigned char stopped[DETACH_BATCH];
+    DIR* dir = open_tasks(pid, procfd);
+    int done = 0;
+    while (!done) {
+        int count = 0;
+        if (dir == NULL) {
+            tids[count++] = pid;
+            done = 1;
+        }
+        while (!done && (count < DETACH_BATCH)) {
+            struct dirent* ent = readdir(dir);
+            if (ent == NULL) {
+                done = 1;
+            } else if (atoi(ent->d_name) > 0) {
+                tids[count++] = atoi(ent->d_name);
+            }
+        }
+
+        // clearing options only succeeds in a ptrace-stop, so it doubles as the check
+        for (int i = 0; i < count; i++) {
+            stopped[i] = ptrace(PTRACE_SETOPTIONS, tids[i], NULL, 0) == 0;
+            if (!stopped[i]) ptrace(PTRACE_INTERRUPT, tids[i], NULL, 0);
+        }
+        for (int i = 0; i < count; i++) {
+            if (!stopped[i]) {
+                wait_stop(tids[i]);
+                ptrace(PTRACE_SETOPTIONS, tids[i], NULL, 0);
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            trace(PTRACE_DETACH, tids[i], NULL, 0);
+        }
+    }
+    if (dir != NULL) closedir(dir);
+
+    LOGD("[%d] detached (seized)", pid);
+}
@@ -21,13 +21,29 @@
 
 #define WEVENT(s) (((s) & 0xffff0000) >> 16)
 
+// Linux 3.4+, possibly missing from older headers
+#ifndef PTRACE_SEIZE
+#define PTRACE_SEIZE 0x4206
+#endif
+#ifndef PTRACE_INTERRUPT
+#define PTRACE_INTERRUPT 0x4207
+#endif
+#ifndef PTRACE_LISTEN
+#define PTRACE_LISTEN 0x4208
+#endif
+#ifndef PTRACE_EVENT_STOP
+#define PTRACE_EVENT_STOP 128
+#endif
+
+void trace_init();
 long trace(int request, pid_t pid, void *addr, size_t data);
 int cont(pid_t group, pid_t target);
 int stop(pid_t group, pid_t target);
 void wait_stop(pid_t target);
 int stop_and_wait_stop(pid_t group, pid_t target);
 int stop_and_detach(pid_t group, pid_t target);
-void detach_pid(int pid);
+void detach_pid(int pid, int procfd);
+void detach_seized(int pid, int procfd);
 void detach_tid(int pid, int tid);
 
 #endif
\ No newline at end of file
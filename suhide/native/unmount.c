@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/* Unmounting of root-related mounts from an app's mount namespace. The actual work is done by
+ * a thread that does not share its filesystem context with the rest of the process (either a
+ * forked child, or a thread that called unshare(CLONE_FS)), as setns(CLONE_NEWNS) requires that.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <sys/mount.h>
+
+#include "ndklog.h"
+#include "util.h"
+#include "eventlog.h"
+#include "prochandle.h"
+#include "mountinfo.h"
+#include "rules.h"
+#include "plan.h"
+#include "unmount.h"
+
+// our own mount namespace, to return to after cleaning an app's namespace
+static int self_ns = -1;
+
+// remember our own mount namespace, must be called before any unmount_root(), returns 0 on success
+int unmount_init() {
+    if (self_ns >= 0) return 0;
+    self_ns = open("/proc/self/ns/mnt", O_RDONLY | O_CLOEXEC);
+    return self_ns >= 0 ? 0 : 1;
+}
+
+// unmount a single mount point, updating result
+static void unmount_target(pid_t pid, const char* target, struct unmount_result* result) {
+    if (umount2(target, MNT_DETACH) == 0) {
+        LOGD("[%d] [%s] unmounted", pid, target);
+        result->unmounted++;
+    } else {
+        LOGD("[%d] [%s] unmount failed", pid, target);
+        eventlog_write(EVENTLOG_UNMOUNT_FAIL, pid, 0, 0, errno, 0);
+        result->failed++;
+    }
+}
+
+// unmount the mounts from a plan
+static void apply_plan(pid_t pid, const struct plan* plan, struct unmount_result* result) {
+    result->skipped = plan->covered;
+    for (int i = 0; i < plan->count; i++) {
+        for (int j = 0; j < plan->entries[i].unmounts; j++) {
+            unmount_target(pid, plan->entries[i].target, result);
+        }
+    }
+}
+
+// enumerate the current namespace's mounts and unmount those matching rules
+static void scan(pid_t pid, const struct rules* rules, struct unmount_result* result) {
+    // /proc/self would show the thread group leader's namespace, not ours
+    char mountinfo[PATH_MAX];
+    snprintf(mountinfo, PATH_MAX, "/proc/self/task/%d/mountinfo", (int)syscall(__NR_gettid));
+    int fd = open(mountinfo, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGD("[%d] failed to read mountinfo", pid);
+        return;
+    }
+
+    // the whole table is read into a plan before unmounting, doing so while reading could make
+    // the kernel skip lines
+    struct plan* plan = plan_build(fd, rules);
+    close(fd);
+    if (plan != NULL) {
+        apply_plan(pid, plan, result);
+        plan_release(plan);
+    }
+}
+
+// see unmount_root(), without timing
+static int enter_and_unmount(const struct proc_handle* zygote, const struct proc_handle* app, const struct rules* rules, const struct plan* plan, struct unmount_result* result) {
+    pid_t pid = app->pid;
+    (void)pid; // unused variable error
+
+    char ns1[PATH_MAX];
+    char ns2[PATH_MAX];
+    ssize_t len1 = proc_readlinkat(zygote, "ns/mnt", ns1, PATH_MAX - 1);
+    ssize_t len2 = proc_readlinkat(app, "ns/mnt", ns2, PATH_MAX - 1);
+    if ((len1 <= 0) || (len2 <= 0)) {
+        // can't tell if the app has its own namespace, which is not the same as knowing it doesn't
+        LOGD("[%d] failed to read namespace", pid);
+        result->failed = 1;
+        return 0;
+    }
+    ns1[len1] = '\0';
+    ns2[len2] = '\0';
+    if (strcmp(ns1, ns2) == 0) return 0;
+
+    // we truly have different namespaces
+    if (proc_setns_mnt(app) != 0) {
+        LOGD("[%d] failed to join namespace", pid);
+        return 0;
+    }
+    result->entered = 1;
+
+    if (plan != NULL) {
+        result->planned = 1;
+        apply_plan(pid, plan, result);
+        if (result->failed > 0) {
+            // namespace differs from what zygote's looked like, do it the slow way
+            LOGD("[%d] plan failed, scanning", pid);
+            result->unmounted = 0;
+            result->failed = 0;
+            result->skipped = 0;
+            scan(pid, rules, result);
+        }
+    } else {
+        scan(pid, rules, result);
+    }
+
+    if (syscall(__NR_setns, self_ns, CLONE_NEWNS) != 0) {
+        LOGD("[%d] failed to return to own namespace", pid);
+        return 1;
+    }
+    return 0;
+}
+
+// unmount all root-related mounts from pid; enters the target's namespace, enumerates mounts,
+// unmounts those in plan (or matching rules if there is no plan or it does not fit), and
+// returns to our own namespace. The calling thread must not
+// share its filesystem context (see unshare(CLONE_FS)). Returns 0 if we are back in our own
+// namespace (or never left it), 1 if returning failed and the calling thread is unusable
+int unmount_root(const struct proc_handle* zygote, const struct proc_handle* app, const struct rules* rules, const struct plan* plan, struct unmount_result* result) {
+    memset(result, 0, sizeof(*result));
+    result->started = monotonic_ns();
+    int ret = enter_and_unmount(zygote, app, rules, plan, result);
+    result->finished = monotonic_ns();
+    return ret;
+}
+
+// start unmounting all root-related mounts from pid in a forked child, see unmount_root().
+// Returns the child's pid, which the caller must reap, or -1 if the fork failed
+pid_t unmount_root_async(const struct proc_handle* zygote, const struct proc_handle* app, const struct rules* rules, const struct plan* plan) {
+    pid_t child = fork();
+    if (child == 0) {
+        struct unmount_result result;
+        unmount_root(zygote, app, rules, plan, &result);
+        exit(EXIT_SUCCESS);
+    }
+    return child;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2017 Jorrit "Chainfire" Jongma & CCMT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _UNMOUNT_H
+#define _UNMOUNT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "prochandle.h"
+#include "rules.h"
+#include "plan.h"
+
+// outcome of unmounting a single namespace
+struct unmount_result {
+    int entered;    // namespace was different from zygote's and could be entered
+    int unmounted;  // number of successful unmounts
+    int failed;     // number of failed unmounts
+    int planned;    // zygote's precomputed plan was tried, counts are from the scan if it failed
+    int skipped;    // unmounts avoided because an ancestor mount was detached
+    uint64_t started;   // monotonic_ns() when unmount_root() was entered
+    uint64_t finished;  // and when it returned
+};
+
+int unmount_init();
+int unmount_root(const struct proc_handle* zygote, const struct proc_handle* app, const struct rules* rules, const struct plan* plan, struct unmount_result* result);
+pid_t unmount_root_async(const struct proc_handle* zygote, const struct proc_handle* app, const struct rules* rules, const struct plan* plan);
+
+#endif
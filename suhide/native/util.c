@@ -144,3 +144,10 @@ int timestamp_diff_ms(struct timeval x, struct timeval y) {
     }
     return ((x.tv_sec - y.tv_sec) * 1000) + ((x.tv_usec - y.tv_usec) / 1000);
 }
+
+// get current CLOCK_MONOTONIC time in ns, for measuring intervals
+uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
@@ -17,6 +17,8 @@
 #ifndef _UTIL_H
 #define _UTIL_H
 
+#include <stdint.h>
+
 #ifndef DEBUG
 void prettify(int argc, char* argv[], char* pretty);
 #endif
@@ -28,4 +30,6 @@ int ms_sleep(int ms);
 struct timeval timestamp();
 int timestamp_diff_ms(struct timeval x, struct timeval y);
 
+uint64_t monotonic_ns();
+
 #endif
\ No newline at end of file
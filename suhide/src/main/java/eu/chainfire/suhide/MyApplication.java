@@ -302,6 +302,7 @@ public class MyApplication extends Application {
         commands.add("chmod 0600 /sbin/supersu/suhide/suhide.pkg");
         commands.add("chcon u:object_r:system_file:s0 /sbin/supersu/suhide/suhide.uid");
         commands.add("chcon u:object_r:system_file:s0 /sbin/supersu/suhide/suhide.pkg");
+        commands.add("/sbin/supersu/suhide/suhide_compile");
 
         rootShell.addCommand(commands);
     }